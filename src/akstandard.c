@@ -147,6 +147,55 @@ void *freadArray(int size, int *len, int nterm, FILE *fp) {
 }
 
 
+/* As fwriteArray and freadArray, but with a long length, so arrays
+   can be larger than 2GB */
+void fwriteArrayLong(void *a, long size, long len, FILE *fp) {
+  long nbytes = len*size;
+  fwrite((void*)(&nbytes),sizeof(long),1,fp);
+  fwrite(a,1,nbytes,fp);
+}
+
+void *freadArrayLong(long size, long *len, int nterm, FILE *fp) {
+  char *a;
+  long i, nbytes;
+  long n=nterm*size;
+  if ( fread(&nbytes,sizeof(long),1,fp)!=1 ) ERROR("freadArrayLong: could not read length",1);
+  if (len) {
+    *len = nbytes/size;
+    if ( *len*size != nbytes ) ERROR("freadArrayLong: nbytes not divisable by size",1);
+  }
+  a = (char*)malloc(nbytes+n);
+  if ( (long)fread((void*)a,1,nbytes,fp)!=nbytes ) ERROR("freadArrayLong: file too short",1);
+  for (i=0; i<n; ++i) a[nbytes+i]=0;
+  return (void*)a;
+}
+
+
+/* Write zeros until the file position is divisible by 8, so the array
+   written next is aligned when the file is memory mapped */
+void falignArrayLong(FILE *fp) {
+  long pos = ftell(fp);
+  char zero[8] = {0,0,0,0,0,0,0,0};
+  if (pos%8) fwrite(zero, 1, 8-pos%8, fp);
+}
+
+/* For a file written with falignArrayLong and fwriteArrayLong and
+   memory mapped to map (maplen bytes): point *a to the array at the
+   first position >= *pos divisible by 8 and move *pos past it.
+   Returns the length of the array in bytes (-1 if the file is truncated) */
+long mapArrayLong(char *map, long maplen, long *pos, char **a) {
+  long n;
+  *pos = (*pos+7) & ~7L;
+  if ( *pos+(long)sizeof(long) > maplen ) return -1;
+  n = *((long *)(map+*pos));
+  if ( n<0 || *pos+(long)sizeof(long)+n > maplen ) return -1;
+  *pos += sizeof(long);
+  *a = map+*pos;
+  *pos += n;
+  return n;
+}
+
+
 /* Assumes that length of string is <256 - otherwise truncate */
 void fwriteShortString(char *str, FILE *fp) {
   uchar ul;
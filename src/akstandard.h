@@ -41,6 +41,10 @@ FILE *find_dir_open_file(List *paths, char *nm);
 
 void fwriteArray(void *a, int size, int len, FILE *fp);
 void *freadArray(int size, int *len, int nterm, FILE *fp);
+void fwriteArrayLong(void *a, long size, long len, FILE *fp);
+void *freadArrayLong(long size, long *len, int nterm, FILE *fp);
+void falignArrayLong(FILE *fp);
+long mapArrayLong(char *map, long maplen, long *pos, char **a);
 void fwriteShortString(char *str, FILE *fp);
 char *freadShortString(FILE *fp);
 
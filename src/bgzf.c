@@ -0,0 +1,508 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  Reading gzip and BGZF compressed files (see bgzf.h)
+
+  Example:
+
+  fb = gzip_fileBuffer(fp,0,4);
+  if ( ReadSequenceFileHeader_fileBuffer(fb,'@') )
+    while ( (seq=readFastq_fileBuffer(fb,dna,qual,0)) ) { ...; free_Sequence(seq); }
+  free_fileBuffer(fb);      // fp is not closed
+
+  A BGZF block is a gzip stream with an extra header field giving the
+  size of the block, so the master can cut the input in blocks without
+  decompressing. Jobs of BGZF_JOB_BLOCKS blocks are decompressed by the
+  workers and copied to the fileBuffer in order.
+
+  Writing:
+
+  wb = bgzf_writeBuffer(fp,0,4,-1);
+  while ( (seq=readFastq_fileBuffer(fb,dna,qual,1)) ) {
+    writeFastq(wb,seq,dna->a,qual->a);
+    free_Sequence(seq);
+  }
+  free_writeBuffer(wb);     // Writes the last blocks (fp is not closed)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef NOZLIB
+#include <zlib.h>
+#endif
+
+#include "inThreads.h"
+#include "fileBuffer.h"
+#include "bgzf.h"
+
+#define GZ_HEADER 18          // Length of a BGZF block header
+#define GZ_INSIZE (1<<20)     // Input buffer for single stream gzip
+#define BGZF_MAX_BLOCK 65536
+
+
+typedef struct {
+  unsigned char *in;     // The compressed blocks
+  int nblocks;
+  long *inpos;           // Start of each block in in (nblocks+1)
+  char *out;             // Decompressed data
+  long *outpos;          // Start of each block in out (nblocks+1)
+} bgzfJob;
+
+
+typedef struct {
+  FILE *fp;
+  unsigned char head[GZ_HEADER];  // Bytes read while checking the format
+  int nhead;
+  int headpos;
+  int eof;               // Set when all input has been read
+#ifndef NOZLIB
+  z_stream zs;
+#endif
+  unsigned char *in;     // Input buffer for single stream gzip
+  int ended;             // Set at the end of a gzip stream
+  inThreads *threads;    // For BGZF
+  int max_jobs;
+  int jobs;              // Jobs queued and not yet returned
+  bgzfJob *current;      // Job being copied to the fileBuffer
+  long pos;              // Position in current->out
+} gzSource;
+
+
+// Checks that h is the header of a BGZF block
+static int is_bgzf(unsigned char *h) {
+  return ( h[0]==31 && h[1]==139 && h[2]==8 && (h[3]&4) && h[10]==6 && h[11]==0
+	   && h[12]=='B' && h[13]=='C' && h[14]==2 && h[15]==0 );
+}
+
+
+static unsigned int little_endian32(unsigned char *p) {
+  return (unsigned int)p[0] | ((unsigned int)p[1]<<8) | ((unsigned int)p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+
+
+// Read n bytes, first from the bytes read when checking the format
+static long read_input(gzSource *src, unsigned char *dest, long n) {
+  long k=0;
+  if (src->headpos<src->nhead) {
+    k = MINIMUM(n, src->nhead-src->headpos);
+    memcpy(dest, src->head+src->headpos, k);
+    src->headpos += k;
+  }
+  if (k<n) k += (long)fread(dest+k, 1, n-k, src->fp);
+  if (k<n) src->eof = 1;
+  return k;
+}
+
+
+static void free_bgzfJob(bgzfJob *job) {
+  if (job->in) free(job->in);
+  if (job->out) free(job->out);
+  free(job->inpos);
+  free(job->outpos);
+  free(job);
+}
+
+
+
+#ifndef NOZLIB
+
+/*
+  Read the next BGZF_JOB_BLOCKS blocks (fewer at the end of the file).
+  Returns NULL if there are no more blocks.
+*/
+static bgzfJob *read_bgzfJob(gzSource *src) {
+  bgzfJob *job;
+  unsigned char *h;
+  long k, bsize, pos=0;
+  int b;
+
+  if (src->eof) return NULL;
+
+  job = (bgzfJob *)malloc(sizeof(bgzfJob));
+  job->in = (unsigned char *)malloc(BGZF_JOB_BLOCKS*BGZF_MAX_BLOCK);
+  job->inpos = (long *)malloc((BGZF_JOB_BLOCKS+1)*sizeof(long));
+  job->outpos = (long *)malloc((BGZF_JOB_BLOCKS+1)*sizeof(long));
+  job->out = NULL;
+  job->inpos[0] = job->outpos[0] = 0;
+
+  for (b=0; b<BGZF_JOB_BLOCKS; ++b) {
+    h = job->in+pos;
+    k = read_input(src, h, GZ_HEADER);
+    if (k==0) break;
+    if ( k<GZ_HEADER || !is_bgzf(h) ) ERROR("gzip_fileBuffer: Truncated or invalid BGZF block",1);
+    bsize = 1 + ((long)h[16] | ((long)h[17]<<8));
+    if ( bsize<GZ_HEADER+8 || read_input(src, h+GZ_HEADER, bsize-GZ_HEADER) < bsize-GZ_HEADER )
+      ERROR("gzip_fileBuffer: Truncated BGZF block",1);
+    pos += bsize;
+    job->inpos[b+1] = pos;
+    // Uncompressed size is the last 4 bytes of the block
+    job->outpos[b+1] = job->outpos[b] + little_endian32(job->in+pos-4);
+  }
+  job->nblocks = b;
+
+  if (b==0) {
+    free_bgzfJob(job);
+    return NULL;
+  }
+  return job;
+}
+
+
+// Worker function decompressing the blocks of a job
+static int inflate_bgzfJob(int thread, void *x) {
+  bgzfJob *job = (bgzfJob *)x;
+  z_stream zs;
+  unsigned char *in;
+  long isize;
+  int b;
+
+  job->out = (char *)malloc(job->outpos[job->nblocks]+1);
+
+  memset(&zs, 0, sizeof(z_stream));
+  if ( inflateInit2(&zs,-15)!=Z_OK ) ERROR("gzip_fileBuffer: inflateInit failed",1);
+  for (b=0; b<job->nblocks; ++b) {
+    in = job->in+job->inpos[b];
+    isize = job->outpos[b+1]-job->outpos[b];
+    inflateReset(&zs);
+    zs.next_in = in+GZ_HEADER;
+    zs.avail_in = job->inpos[b+1]-job->inpos[b]-GZ_HEADER-8;
+    zs.next_out = (unsigned char *)(job->out+job->outpos[b]);
+    zs.avail_out = isize;
+    if ( inflate(&zs,Z_FINISH)!=Z_STREAM_END || zs.avail_out!=0 )
+      ERROR("gzip_fileBuffer: Error in BGZF block",1);
+    if ( crc32(0L, (unsigned char *)(job->out+job->outpos[b]), isize) != little_endian32(in+job->inpos[b+1]-job->inpos[b]-8) )
+      ERROR("gzip_fileBuffer: CRC error in BGZF block",1);
+  }
+  inflateEnd(&zs);
+
+  free(job->in);
+  job->in = NULL;
+
+  return 0;
+}
+
+
+// Keep max_jobs jobs in the queue
+static void queue_bgzf(gzSource *src) {
+  bgzfJob *job;
+  while ( src->jobs<src->max_jobs && (job=read_bgzfJob(src)) ) {
+    new_job_inThreads(src->threads, (void *)job);
+    src->jobs += 1;
+  }
+  if ( src->eof && !src->threads->no_more_jobs ) finished_jobqueue_inThreads(src->threads);
+}
+
+
+// Copy decompressed jobs to dest (waits only if nothing is copied yet)
+static long bgzf_fill(fileBuffer *fb, char *dest, long n) {
+  gzSource *src = (gzSource *)(fb->source);
+  bgzfJob *job;
+  long k, l=0;
+
+  while (l<n) {
+    if (!src->current) {
+      queue_bgzf(src);
+      if (src->jobs==0) break;
+      while ( !(job=(bgzfJob *)next_output_inThreads(src->threads)) ) {
+	if (l>0) return l;
+	millisleep(src->threads->sleep);
+      }
+      src->jobs -= 1;
+      src->current = job;
+      src->pos = 0;
+    }
+    job = src->current;
+    k = MINIMUM(n-l, job->outpos[job->nblocks]-src->pos);
+    memcpy(dest+l, job->out+src->pos, k);
+    l += k;
+    src->pos += k;
+    if ( src->pos==job->outpos[job->nblocks] ) {
+      free_bgzfJob(job);
+      src->current = NULL;
+    }
+  }
+
+  return l;
+}
+
+
+// Decompress directly to dest. Concatenated gzip streams are read as one
+static long gzip_fill(fileBuffer *fb, char *dest, long n) {
+  gzSource *src = (gzSource *)(fb->source);
+  z_stream *zs = &(src->zs);
+  long k;
+  int ret;
+
+  zs->next_out = (unsigned char *)dest;
+  zs->avail_out = n;
+
+  while ( (long)zs->avail_out==n ) {
+    if (zs->avail_in==0) {
+      k = read_input(src, src->in, GZ_INSIZE);
+      if (k==0) {
+	if (!src->ended) ERROR("gzip_fileBuffer: Compressed file is truncated",1);
+	break;
+      }
+      zs->next_in = src->in;
+      zs->avail_in = k;
+    }
+    src->ended = 0;
+    ret = inflate(zs, Z_NO_FLUSH);
+    if (ret==Z_STREAM_END) {
+      src->ended = 1;
+      inflateReset(zs);
+    }
+    else if (ret!=Z_OK) ERROR("gzip_fileBuffer: Error in compressed data",1);
+  }
+
+  return n-(long)zs->avail_out;
+}
+
+#endif
+
+
+static void gzip_close(fileBuffer *fb) {
+  gzSource *src = (gzSource *)(fb->source);
+  bgzfJob *job;
+
+  if (src->threads) {
+    if (!src->threads->no_more_jobs) finished_jobqueue_inThreads(src->threads);
+    while ( src->jobs>0 ) {
+      while ( !(job=(bgzfJob *)next_output_inThreads(src->threads)) ) millisleep(src->threads->sleep);
+      free_bgzfJob(job);
+      src->jobs -= 1;
+    }
+    cleanup_inThreads(src->threads);
+    if (src->current) free_bgzfJob(src->current);
+  }
+#ifndef NOZLIB
+  else inflateEnd(&(src->zs));
+#endif
+  if (src->in) free(src->in);
+  free(src);
+  fb->source = NULL;
+}
+
+
+/*
+  Returns a fileBuffer (of the given size, default if <=0) reading fp.
+  If fp is gzip compressed the data is decompressed, and BGZF blocks are
+  decompressed by nthreads workers. With nthreads<=0 no threads are
+  started and BGZF is decompressed as one stream (as other gzip files),
+  e.g. when each file is already read by its own worker.
+  fp is not closed by free_fileBuffer.
+*/
+fileBuffer *gzip_fileBuffer(FILE *fp, long size, int nthreads) {
+  fileBuffer *fb = alloc_fileBuffer(fp, (size>0 && size<GZ_HEADER ? GZ_HEADER : size));
+  gzSource *src;
+  unsigned char h[GZ_HEADER];
+  long n;
+
+  n = (long)fread(h, 1, GZ_HEADER, fp);
+  if ( n<2 || h[0]!=31 || h[1]!=139 ) {
+    // Not compressed
+    memcpy(fb->buf, h, n);
+    fb->len = n;
+    return fb;
+  }
+
+#ifdef NOZLIB
+  ERROR("gzip_fileBuffer: aklib is compiled without zlib, so compressed files cannot be read",1);
+#endif
+
+  src = (gzSource *)calloc(1,sizeof(gzSource));
+  src->fp = fp;
+  memcpy(src->head, h, n);
+  src->nhead = n;
+  fb->source = (void *)src;
+  fb->close = gzip_close;
+
+#ifndef NOZLIB
+  if ( nthreads>0 && n==GZ_HEADER && is_bgzf(h) ) {
+    src->max_jobs = 2*nthreads+1;
+    src->threads = init_inThreads(nthreads, inflate_bgzfJob);
+    start_inThreads(src->threads);
+    fb->fill = bgzf_fill;
+  }
+  else {
+    if ( inflateInit2(&(src->zs),15+16)!=Z_OK ) ERROR("gzip_fileBuffer: inflateInit failed",1);
+    src->in = (unsigned char *)malloc(GZ_INSIZE);
+    fb->fill = gzip_fill;
+  }
+#endif
+
+  return fb;
+}
+
+
+
+
+/*************************************************
+
+Writing BGZF
+
+Each flush of the writeBuffer becomes a job, which a worker cuts in
+blocks of BGZF_BLOCK_DATA bytes and compresses. Finished jobs are
+written in order at later flushes, and the master only waits if
+2*nthreads jobs are queued.
+
+*************************************************/
+
+// The empty block marking the end of a BGZF file
+static const unsigned char bgzf_eof[28] = { 31,139,8,4,0,0,0,0,0,255,6,0,'B','C',2,0,27,0,3,0,0,0,0,0,0,0,0,0 };
+
+
+typedef struct {
+  char *data;
+  long n;
+  int level;
+  unsigned char *out;    // Compressed blocks
+  long outlen;
+} bgzfWriteJob;
+
+
+typedef struct {
+  FILE *fp;
+  int level;
+  inThreads *threads;
+  int max_jobs;
+  int jobs;              // Jobs queued and not yet written
+} bgzfWriter;
+
+
+static void put_little_endian(unsigned char *p, unsigned int x, int n) {
+  int i;
+  for (i=0; i<n; ++i) { p[i] = x&255; x >>= 8; }
+}
+
+
+#ifndef NOZLIB
+
+// Worker function compressing the blocks of a job
+static int deflate_bgzfJob(int thread, void *x) {
+  bgzfWriteJob *job = (bgzfWriteJob *)x;
+  z_stream zs;
+  unsigned char *h;
+  long i, k, nblocks = (job->n+BGZF_BLOCK_DATA-1)/BGZF_BLOCK_DATA;
+
+  job->out = (unsigned char *)malloc(nblocks*BGZF_MAX_BLOCK);
+  job->outlen = 0;
+
+  memset(&zs, 0, sizeof(z_stream));
+  if ( deflateInit2(&zs, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK )
+    ERROR("bgzf_writeBuffer: deflateInit failed",1);
+  for (i=0; i<job->n; i+=k) {
+    k = MINIMUM(BGZF_BLOCK_DATA, job->n-i);
+    h = job->out+job->outlen;
+    memcpy(h, bgzf_eof, GZ_HEADER);
+    deflateReset(&zs);
+    zs.next_in = (unsigned char *)(job->data+i);
+    zs.avail_in = k;
+    zs.next_out = h+GZ_HEADER;
+    zs.avail_out = BGZF_MAX_BLOCK-GZ_HEADER-8;
+    if ( deflate(&zs,Z_FINISH)!=Z_STREAM_END ) ERROR("bgzf_writeBuffer: Block does not fit",1);
+    put_little_endian(h+GZ_HEADER+zs.total_out, crc32(0L, (unsigned char *)(job->data+i), k), 4);
+    put_little_endian(h+GZ_HEADER+zs.total_out+4, k, 4);
+    put_little_endian(h+16, GZ_HEADER+zs.total_out+8-1, 2);
+    job->outlen += GZ_HEADER+zs.total_out+8;
+  }
+  deflateEnd(&zs);
+
+  free(job->data);
+  job->data = NULL;
+
+  return 0;
+}
+
+#endif
+
+
+/*
+  Write finished jobs in order. If wait!=0 at least one is written (if
+  any are queued).
+*/
+static void write_bgzf(bgzfWriter *w, int wait) {
+  bgzfWriteJob *job;
+
+  while ( w->jobs>0 ) {
+    job = (bgzfWriteJob *)next_output_inThreads(w->threads);
+    if (!job) {
+      if (!wait) return;
+      millisleep(w->threads->sleep);
+      continue;
+    }
+    if ( (long)fwrite(job->out, 1, job->outlen, w->fp)!=job->outlen ) ERROR("bgzf_writeBuffer: Write failed",1);
+    free(job->out);
+    free(job);
+    w->jobs -= 1;
+    wait = 0;
+  }
+}
+
+
+// The data is copied to a job (the writeBuffer reuses its buffer)
+static long bgzf_flush(writeBuffer *wb, char *data, long n) {
+  bgzfWriter *w = (bgzfWriter *)(wb->dest);
+  bgzfWriteJob *job = (bgzfWriteJob *)malloc(sizeof(bgzfWriteJob));
+
+  job->data = (char *)malloc(n);
+  memcpy(job->data, data, n);
+  job->n = n;
+  job->level = w->level;
+  job->out = NULL;
+  new_job_inThreads(w->threads, (void *)job);
+  w->jobs += 1;
+
+  write_bgzf(w, (w->jobs>=w->max_jobs));
+
+  return n;
+}
+
+
+// Write all jobs and the end-of-file block
+static void bgzf_close(writeBuffer *wb) {
+  bgzfWriter *w = (bgzfWriter *)(wb->dest);
+
+  finished_jobqueue_inThreads(w->threads);
+  while (w->jobs>0) write_bgzf(w, 1);
+  cleanup_inThreads(w->threads);
+  if ( fwrite(bgzf_eof, 1, 28, w->fp)!=28 ) ERROR("bgzf_writeBuffer: Write failed",1);
+  free(w);
+  wb->dest = NULL;
+}
+
+
+/*
+  Returns a writeBuffer (of the given size, default if <=0) writing BGZF
+  to fp with compression level (0-9, -1 gives zlib's default) using
+  nthreads workers. free_writeBuffer must be called to finish the file.
+*/
+writeBuffer *bgzf_writeBuffer(FILE *fp, long size, int nthreads, int level) {
+  writeBuffer *wb = alloc_writeBuffer(fp, size);
+#ifdef NOZLIB
+  ERROR("bgzf_writeBuffer: aklib is compiled without zlib, so compressed files cannot be written",1);
+#else
+  bgzfWriter *w;
+
+  if (nthreads<1) nthreads=1;
+  if (level<0 || level>9) level = Z_DEFAULT_COMPRESSION;
+  w = (bgzfWriter *)malloc(sizeof(bgzfWriter));
+  w->fp = fp;
+  w->level = level;
+  w->max_jobs = 2*nthreads;
+  w->jobs = 0;
+  w->threads = init_inThreads(nthreads, deflate_bgzfJob);
+  start_inThreads(w->threads);
+
+  wb->flush = bgzf_flush;
+  wb->close = bgzf_close;
+  wb->dest = (void *)w;
+#endif
+
+  return wb;
+}
@@ -0,0 +1,42 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef BGZF_H
+#define BGZF_H
+
+/*
+  Reading gzip compressed files
+
+  gzip_fileBuffer looks at the first bytes of the stream, and if it is
+  gzip compressed, the fileBuffer gives the decompressed data, so all the
+  fileBuffer readers work on compressed files. Files in the BGZF format
+  (from bgzip, samtools etc) consist of independent blocks of at most 64kb
+  that are decompressed in parallel by inThreads workers (unless nthreads
+  is 0). Other gzip files (also several concatenated gzip streams) are
+  decompressed by zlib in one stream. Uncompressed files are read as by
+  alloc_fileBuffer.
+
+  bgzf_writeBuffer gives a writeBuffer (see fileBuffer.h) that writes
+  BGZF. Each full buffer is cut in blocks that are compressed by
+  inThreads workers and written in order, and free_writeBuffer writes the
+  BGZF end-of-file block. The output is a valid gzip file, which can be
+  indexed by bgzip and samtools.
+
+  Programs must be linked with -lz (unless aklib is compiled with
+  -DNOZLIB, in which case compressed input or output is an error).
+
+  Include akstandard.h (or inThreads.h) and fileBuffer.h before this file.
+*/
+
+// Number of BGZF blocks decompressed in one job
+#define BGZF_JOB_BLOCKS 64
+// Max uncompressed data in a block written (as bgzip)
+#define BGZF_BLOCK_DATA 0xff00
+
+fileBuffer *gzip_fileBuffer(FILE *fp, long size, int nthreads);
+writeBuffer *bgzf_writeBuffer(FILE *fp, long size, int nthreads, int level);
+
+#endif
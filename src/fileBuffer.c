@@ -0,0 +1,484 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "akstandard.h"
+#include "fileBuffer.h"
+
+
+// Default fill function reading from fp
+static long fread_fill(fileBuffer *fb, char *dest, long n) {
+  return (long)fread(dest, 1, n, fb->fp);
+}
+
+
+/*
+  Allocate a buffer of the given size for reading fp
+  (if size<=0 the default size is used)
+*/
+fileBuffer *alloc_fileBuffer(FILE *fp, long size) {
+  fileBuffer *fb = (fileBuffer *)malloc(sizeof(fileBuffer));
+  if (size<=0) size = FB_default_size;
+  fb->fp = fp;
+  fb->size = size;
+  fb->buf = (char *)malloc(size*sizeof(char));
+  fb->len = fb->pos = fb->offset = 0;
+  fb->eof = 0;
+  fb->flag = 0;
+  setBit(fb->flag,FB_ownbuf);
+  fb->fill = fread_fill;
+  fb->close = NULL;
+  fb->source = NULL;
+  return fb;
+}
+
+
+/*
+  Make a fileBuffer of data already in memory (len bytes)
+  The data is not copied and not freed with the buffer.
+*/
+fileBuffer *memory_fileBuffer(char *data, long len, int writable) {
+  fileBuffer *fb = (fileBuffer *)malloc(sizeof(fileBuffer));
+  fb->fp = NULL;
+  fb->buf = data;
+  fb->size = fb->len = len;
+  fb->pos = fb->offset = 0;
+  fb->eof = 1;
+  fb->flag = 0;
+  if (writable) setBit(fb->flag,FB_writable);
+  fb->fill = NULL;
+  fb->close = NULL;
+  fb->source = NULL;
+  return fb;
+}
+
+
+/*
+  Memory map a whole file and return it as a fileBuffer
+
+  If writable!=0 the mapping is private (copy-on-write), so the buffer
+  can be changed (e.g. translated) without changing the file. Only pages
+  that are changed take up extra memory.
+
+  Returns NULL if the file cannot be opened or mapped.
+*/
+fileBuffer *mmap_fileBuffer(char *filename, int writable) {
+  int fd;
+  struct stat st;
+  char *map;
+  fileBuffer *fb;
+
+  fd = open(filename, O_RDONLY);
+  if (fd<0) return NULL;
+  if ( fstat(fd,&st)!=0 ) { close(fd); return NULL; }
+
+  map = NULL;
+  if (st.st_size>0) {
+    map = (char *)mmap(NULL, st.st_size, PROT_READ | (writable?PROT_WRITE:0), MAP_PRIVATE, fd, 0);
+    if (map==MAP_FAILED) { close(fd); return NULL; }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  fb = memory_fileBuffer(map, st.st_size, writable);
+  if (map) setBit(fb->flag,FB_mmap);
+  return fb;
+}
+
+
+// The stream is not closed
+void free_fileBuffer(fileBuffer *fb) {
+  if (fb) {
+    if (fb->close) fb->close(fb);
+    if (fb->buf && checkBit(fb->flag,FB_ownbuf)) free(fb->buf);
+    if (fb->buf && checkBit(fb->flag,FB_mmap)) munmap(fb->buf, fb->size);
+    free(fb);
+  }
+}
+
+
+/*
+  Move unread data to the beginning of the buffer and read more.
+  If the buffer is full of unread data, it is doubled in size.
+  Returns the number of new bytes (0 on EOF)
+*/
+long refill_fileBuffer(fileBuffer *fb) {
+  long n, left;
+
+  if (fb->eof || !fb->fill) { fb->eof=1; return 0; }
+
+  // The fill function gives a new buffer with the unread data first
+  if (checkBit(fb->flag,FB_fillbuf)) {
+    n = fb->fill(fb, NULL, 0);
+    if (n<=0) fb->eof=1;
+    return MAXIMUM(n,0);
+  }
+
+  left = fb->len - fb->pos;
+  if (fb->pos>0) {
+    if (left>0) memmove(fb->buf, fb->buf+fb->pos, left);
+    fb->offset += fb->pos;
+    fb->pos = 0;
+    fb->len = left;
+  }
+  if (fb->len==fb->size) {
+    if (!checkBit(fb->flag,FB_ownbuf)) ERROR("refill_fileBuffer: Cannot grow buffer",1);
+    fb->size *= 2;
+    fb->buf = (char *)realloc(fb->buf, fb->size*sizeof(char));
+  }
+
+  n = fb->fill(fb, fb->buf+fb->len, fb->size-fb->len);
+  if (n<=0) { fb->eof=1; return 0; }
+  fb->len += n;
+
+  return n;
+}
+
+
+/*
+  Returns a pointer to the next line in the buffer and its length (without
+  the newline) in *len. The position is moved past the newline.
+  The line is NOT terminated by 0.
+  A last line without newline is also returned.
+  Returns NULL on EOF.
+*/
+char *next_line_fileBuffer(fileBuffer *fb, long *len) {
+  char *nl, *start;
+  long scanned=0;
+
+  while ( 1 ) {
+    start = fb->buf+fb->pos;
+    nl = (char *)memchr(start+scanned, '\n', fb->len-fb->pos-scanned);
+    if (nl) break;
+    scanned = fb->len-fb->pos;
+    if ( refill_fileBuffer(fb)==0 ) {
+      // Last line without newline
+      *len = scanned;
+      if (scanned==0) return NULL;
+      start = fb->buf+fb->pos;
+      fb->pos = fb->len;
+      return start;
+    }
+  }
+
+  *len = nl-start;
+  fb->pos += *len+1;
+  return start;
+}
+
+
+// Skip past next newline. Returns number of chars skipped (-1 on EOF)
+long skip_line_fileBuffer(fileBuffer *fb) {
+  long len;
+  if ( next_line_fileBuffer(fb, &len) ) return len;
+  return -1;
+}
+
+
+// Read n bytes into dest. Returns number of bytes read
+long read_fileBuffer(fileBuffer *fb, char *dest, long n) {
+  long k, l=0;
+  while (l<n) {
+    if ( fb->pos >= fb->len && refill_fileBuffer(fb)==0 ) break;
+    k = MINIMUM(n-l, fb->len-fb->pos);
+    memcpy(dest+l, fb->buf+fb->pos, k);
+    fb->pos += k;
+    l += k;
+  }
+  return l;
+}
+
+
+
+
+/*************************************************
+
+Read-ahead
+
+A thread reads the stream into a ring of nbuf buffers while the parser
+works on the data already read. At a refill the fileBuffer takes the
+next full buffer from the ring and gives its own buffer back, so the
+data is not copied. The unread tail of the old buffer is copied in
+front of the new data, where the thread leaves FB_readahead_head bytes
+free. Only a longer tail (a line or record longer than that) is
+handled by copying the new data after the tail instead. The fill
+function only waits if no buffer is ready.
+
+  fb = readahead_fileBuffer(fp,0,0);
+  ReadSequenceFileHeader_fileBuffer(fb,'>');
+  while ( (seq=readFasta_fileBuffer(fb,alph,1)) ) ...
+  free_fileBuffer(fb);     // Stops the thread (fp is not closed)
+
+*************************************************/
+
+#define FB_readahead_head (1<<16)
+
+typedef struct {
+  FILE *fp;
+  int nbuf;
+  long bufsize;      // Bytes read into a buffer at a time (after the head)
+  char **buf;
+  long *alloc;       // Allocated size of each buffer
+  long *len;         // Bytes read into each buffer
+  char *cur;         // The buffer used by the fileBuffer
+  long curalloc;
+  int head;          // Next buffer to read into
+  int tail;          // Next buffer to give to the fileBuffer
+  int nfull;         // Buffers read and not yet used
+  int eof;
+  int stop;          // Tells the thread to stop
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} readAhead;
+
+
+static void *readahead_thread(void *x) {
+  readAhead *ra = (readAhead *)x;
+  long n;
+  int stop;
+
+  while (1) {
+    pthread_mutex_lock(&(ra->lock));
+    while ( ra->nfull==ra->nbuf && !ra->stop ) pthread_cond_wait(&(ra->cond), &(ra->lock));
+    stop = ra->stop;
+    pthread_mutex_unlock(&(ra->lock));
+    if (stop) break;
+
+    // The head buffer is not used by the reader, so it is filled without lock
+    n = (long)fread(ra->buf[ra->head]+FB_readahead_head, 1, ra->bufsize, ra->fp);
+
+    pthread_mutex_lock(&(ra->lock));
+    if (n>0) {
+      ra->len[ra->head] = n;
+      ra->head = (ra->head+1)%ra->nbuf;
+      ra->nfull += 1;
+    }
+    else ra->eof = 1;
+    pthread_cond_broadcast(&(ra->cond));
+    pthread_mutex_unlock(&(ra->lock));
+    if (n<=0) break;
+  }
+  return NULL;
+}
+
+
+/*
+  Fill function (called by refill_fileBuffer with dest NULL): swap the
+  next full buffer in (waits only if there are none). Returns the number
+  of new bytes (0 on EOF).
+*/
+static long readahead_fill(fileBuffer *fb, char *dest, long n) {
+  readAhead *ra = (readAhead *)(fb->source);
+  long left = fb->len-fb->pos, alloc;
+  char *data, *swap;
+
+  pthread_mutex_lock(&(ra->lock));
+  while ( ra->nfull==0 && !ra->eof ) pthread_cond_wait(&(ra->cond), &(ra->lock));
+  n = ( ra->nfull>0 ? ra->len[ra->tail] : 0 );
+  pthread_mutex_unlock(&(ra->lock));
+  if (n==0) return 0;
+
+  data = ra->buf[ra->tail]+FB_readahead_head;
+  if (left<=FB_readahead_head) {
+    memcpy(data-left, fb->buf+fb->pos, left);
+    swap = ra->cur;
+    alloc = ra->curalloc;
+    ra->cur = ra->buf[ra->tail];
+    ra->curalloc = ra->alloc[ra->tail];
+    ra->buf[ra->tail] = swap;
+    ra->alloc[ra->tail] = alloc;
+    fb->buf = data-left;
+    fb->size = ra->curalloc-(FB_readahead_head-left);
+  }
+  else {
+    // Long tail: move it to the start of the current buffer and append
+    memmove(ra->cur, fb->buf+fb->pos, left);
+    if (left+n > ra->curalloc) {
+      ra->curalloc = 2*(left+n);
+      ra->cur = (char *)realloc(ra->cur, ra->curalloc*sizeof(char));
+    }
+    memcpy(ra->cur+left, data, n);
+    fb->buf = ra->cur;
+    fb->size = ra->curalloc;
+  }
+  fb->offset += fb->pos;
+  fb->pos = 0;
+  fb->len = left+n;
+
+  pthread_mutex_lock(&(ra->lock));
+  ra->tail = (ra->tail+1)%ra->nbuf;
+  ra->nfull -= 1;
+  pthread_cond_broadcast(&(ra->cond));
+  pthread_mutex_unlock(&(ra->lock));
+
+  return n;
+}
+
+
+static void readahead_close(fileBuffer *fb) {
+  readAhead *ra = (readAhead *)(fb->source);
+  int i;
+
+  pthread_mutex_lock(&(ra->lock));
+  ra->stop = 1;
+  pthread_cond_broadcast(&(ra->cond));
+  pthread_mutex_unlock(&(ra->lock));
+  pthread_join(ra->thread, NULL);
+
+  pthread_mutex_destroy(&(ra->lock));
+  pthread_cond_destroy(&(ra->cond));
+  for (i=0; i<ra->nbuf; ++i) free(ra->buf[i]);
+  free(ra->buf);
+  free(ra->alloc);
+  free(ra->len);
+  free(ra->cur);
+  free(ra);
+  fb->buf = NULL;
+  fb->source = NULL;
+}
+
+
+/*
+  A fileBuffer reading fp with a thread, which reads ahead into nbuf
+  buffers (default FB_readahead_nbuf if <=0) of the given size (default
+  if <=0). At least two buffers are used.
+*/
+fileBuffer *readahead_fileBuffer(FILE *fp, long size, int nbuf) {
+  fileBuffer *fb = memory_fileBuffer(NULL, 0, 0);
+  readAhead *ra = (readAhead *)calloc(1,sizeof(readAhead));
+  int i;
+
+  if (size<=0) size = FB_default_size;
+  if (nbuf<=0) nbuf = FB_readahead_nbuf;
+  if (nbuf<2) nbuf = 2;
+  ra->fp = fp;
+  ra->nbuf = nbuf;
+  ra->bufsize = size;
+  ra->buf = (char **)malloc(nbuf*sizeof(char *));
+  ra->alloc = (long *)malloc(nbuf*sizeof(long));
+  for (i=0; i<nbuf; ++i) {
+    ra->alloc[i] = FB_readahead_head+size;
+    ra->buf[i] = (char *)malloc(ra->alloc[i]*sizeof(char));
+  }
+  ra->len = (long *)calloc(nbuf,sizeof(long));
+  ra->curalloc = FB_readahead_head+size;
+  ra->cur = (char *)malloc(ra->curalloc*sizeof(char));
+  pthread_mutex_init(&(ra->lock), NULL);
+  pthread_cond_init(&(ra->cond), NULL);
+  if ( pthread_create(&(ra->thread), NULL, readahead_thread, (void *)ra) )
+    ERROR("readahead_fileBuffer: Could not start thread",1);
+
+  fb->fp = fp;
+  fb->buf = ra->cur;
+  fb->eof = 0;
+  setBit(fb->flag,FB_fillbuf);
+  fb->fill = readahead_fill;
+  fb->close = readahead_close;
+  fb->source = (void *)ra;
+
+  return fb;
+}
+
+
+
+/*************************************************
+Block buffered output
+*************************************************/
+
+// Default flush function writing to fp
+static long fwrite_flush(writeBuffer *wb, char *data, long n) {
+  return (long)fwrite(data, 1, n, wb->fp);
+}
+
+
+/*
+  Set up wb for writing to fp using buf of the given size, which the
+  caller owns (for instance on the stack). The buffer cannot grow, so
+  it must have room for the largest reserve_writeBuffer. Finish with
+  flush_writeBuffer instead of free_writeBuffer.
+*/
+void init_writeBuffer(writeBuffer *wb, FILE *fp, char *buf, long size) {
+  wb->fp = fp;
+  wb->size = size;
+  wb->buf = buf;
+  wb->len = wb->offset = 0;
+  wb->flush = fwrite_flush;
+  wb->close = NULL;
+  wb->dest = NULL;
+}
+
+
+/*
+  Allocate a buffer of the given size for writing to fp
+  (if size<=0 the default size is used)
+*/
+writeBuffer *alloc_writeBuffer(FILE *fp, long size) {
+  writeBuffer *wb = (writeBuffer *)malloc(sizeof(writeBuffer));
+  if (size<=0) size = FB_default_size;
+  init_writeBuffer(wb, fp, (char *)malloc(size*sizeof(char)), size);
+  return wb;
+}
+
+
+// Write the content of the buffer (the stream is not flushed)
+void flush_writeBuffer(writeBuffer *wb) {
+  if (wb->len>0) {
+    if ( wb->flush(wb, wb->buf, wb->len)!=wb->len ) ERROR("flush_writeBuffer: Write failed",1);
+    wb->offset += wb->len;
+    wb->len = 0;
+  }
+}
+
+
+// The buffer is flushed, but the stream is not closed
+void free_writeBuffer(writeBuffer *wb) {
+  if (wb) {
+    flush_writeBuffer(wb);
+    if (wb->close) wb->close(wb);
+    free(wb->buf);
+    free(wb);
+  }
+}
+
+
+/*
+  Flush the buffer if there is not room for n more bytes (and make it
+  larger if n>size). Returns a pointer to the free space.
+  The caller adds the number of bytes used to wb->len.
+*/
+char *reserve_writeBuffer(writeBuffer *wb, long n) {
+  if ( wb->len+n > wb->size ) {
+    flush_writeBuffer(wb);
+    if (n > wb->size) {
+      wb->size = n;
+      wb->buf = (char *)realloc(wb->buf, wb->size*sizeof(char));
+    }
+  }
+  return wb->buf+wb->len;
+}
+
+
+// Write n bytes
+void write_writeBuffer(writeBuffer *wb, const char *data, long n) {
+  long k;
+  while (n>0) {
+    if (wb->len==wb->size) flush_writeBuffer(wb);
+    k = MINIMUM(n, wb->size-wb->len);
+    memcpy(wb->buf+wb->len, data, k);
+    wb->len += k;
+    data += k;
+    n -= k;
+  }
+}
@@ -0,0 +1,132 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef FILEBUFFER_H
+#define FILEBUFFER_H
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+  Block buffered input
+
+  Data is read into a large buffer in blocks and the parsers work directly
+  on the buffer (finding line ends with memchr etc) instead of reading one
+  char at a time with fgetc.
+
+  The data comes from the fill function, which reads up to n bytes into
+  dest and returns the number of bytes read (0 on EOF). The default fill
+  function uses fread on fp. If set, the close function is called by
+  free_fileBuffer to clean up the source.
+
+  readahead_fileBuffer gives a fileBuffer where a background thread reads
+  the stream into a ring of buffers, so reading overlaps with parsing.
+  It is used as any other fileBuffer. The parser reads directly from the
+  ring buffers, which are handed to the fileBuffer at each refill
+  (flag FB_fillbuf).
+
+  A line returned by next_line_fileBuffer is a pointer into the buffer and
+  it is only valid until the next call that reads from the buffer.
+*/
+typedef struct _fileBuffer_ {
+  FILE *fp;         // Stream (NULL if data comes from elsewhere)
+  char *buf;        // The buffer
+  long size;        // Allocated size of buf
+  long len;         // Number of valid bytes in buf
+  long pos;         // Current position in buf
+  long offset;      // Position of buf[0] in the stream
+  int eof;          // Set when the fill function has returned 0
+  int flag;         // Bits telling how buf is allocated (see below)
+  long (*fill)(struct _fileBuffer_ *fb, char *dest, long n);
+  void (*close)(struct _fileBuffer_ *fb);
+  void *source;     // Data for the fill function
+} fileBuffer;
+
+// Bits for fileBuffer->flag
+#define FB_ownbuf 1        // buf is malloc'ed and freed with the fileBuffer
+#define FB_mmap 2          // buf is a memory mapped file (unmapped when freed)
+#define FB_writable 3      // buf may be changed (private mapping or memory)
+#define FB_fillbuf 4       // buf is replaced by the fill function (called with dest NULL)
+
+#define FB_default_size (1<<22)
+#define FB_readahead_nbuf 4
+
+
+fileBuffer *alloc_fileBuffer(FILE *fp, long size);
+fileBuffer *memory_fileBuffer(char *data, long len, int writable);
+fileBuffer *mmap_fileBuffer(char *filename, int writable);
+fileBuffer *readahead_fileBuffer(FILE *fp, long size, int nbuf);
+void free_fileBuffer(fileBuffer *fb);
+long refill_fileBuffer(fileBuffer *fb);
+char *next_line_fileBuffer(fileBuffer *fb, long *len);
+long skip_line_fileBuffer(fileBuffer *fb);
+long read_fileBuffer(fileBuffer *fb, char *dest, long n);
+
+
+static inline int getc_fileBuffer(fileBuffer *fb) {
+  if ( fb->pos >= fb->len && refill_fileBuffer(fb)==0 ) return EOF;
+  return (unsigned char)fb->buf[fb->pos++];
+}
+
+// Return next char without consuming it
+static inline int peek_fileBuffer(fileBuffer *fb) {
+  if ( fb->pos >= fb->len && refill_fileBuffer(fb)==0 ) return EOF;
+  return (unsigned char)fb->buf[fb->pos];
+}
+
+// Position of the next char in the stream
+static inline long tell_fileBuffer(fileBuffer *fb) { return fb->offset+fb->pos; }
+
+
+
+/*
+  Block buffered output
+
+  Data is collected in a large buffer and handed to the flush function
+  when the buffer is full (or at flush_writeBuffer). The flush function
+  writes n bytes from data and returns the number written. The default
+  uses fwrite on fp. If set, the close function is called by
+  free_writeBuffer after the last flush.
+*/
+typedef struct _writeBuffer_ {
+  FILE *fp;         // Stream (NULL if data goes elsewhere)
+  char *buf;
+  long size;        // Allocated size of buf
+  long len;         // Number of bytes in buf
+  long offset;      // Number of bytes flushed
+  long (*flush)(struct _writeBuffer_ *wb, char *data, long n);
+  void (*close)(struct _writeBuffer_ *wb);
+  void *dest;       // Data for the flush function
+} writeBuffer;
+
+
+void init_writeBuffer(writeBuffer *wb, FILE *fp, char *buf, long size);
+writeBuffer *alloc_writeBuffer(FILE *fp, long size);
+void flush_writeBuffer(writeBuffer *wb);
+void free_writeBuffer(writeBuffer *wb);
+char *reserve_writeBuffer(writeBuffer *wb, long n);
+void write_writeBuffer(writeBuffer *wb, const char *data, long n);
+
+
+// Make sure there is room for n bytes in the buffer and return a pointer to them
+static inline char *room_writeBuffer(writeBuffer *wb, long n) {
+  if ( wb->len+n <= wb->size ) return wb->buf+wb->len;
+  return reserve_writeBuffer(wb, n);
+}
+
+static inline void putc_writeBuffer(writeBuffer *wb, int c) {
+  *room_writeBuffer(wb,1) = c;
+  wb->len += 1;
+}
+
+static inline void puts_writeBuffer(writeBuffer *wb, const char *s) {
+  write_writeBuffer(wb, s, strlen(s));
+}
+
+// Position of the next char in the output
+static inline long tell_writeBuffer(writeBuffer *wb) { return wb->offset+wb->len; }
+
+#endif
@@ -0,0 +1,330 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  Front coded dictionary of sequence names (see idDict.h)
+
+  Example:
+
+  idDict *d = alloc_idDict(1);
+  seqBatch *b = alloc_seqBatch();
+  b->lazy_id = 1;
+  while ( read_seqBatch(b,fb,'@',dna,qual,0,10000,0) ) {
+    first = add_seqBatch_idDict(d,b);
+    // Sequence i of the batch has number first+i
+    ...
+  }
+  i = lookup_idDict(d,"read123",0);
+  printf("%s\n",name_idDict(d,i));
+
+  Each name is stored as two numbers (shared prefix and length of the
+  rest) written as varints (7 bits per byte, high bit set if more bytes
+  follow) and the rest of the name.
+
+  name_idDict and lookup_idDict use the same buffer, so they should not
+  be called from several threads at a time. decode_idDict with your own
+  buffer can.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "akstandard.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "sequence.h"
+#include "idDict.h"
+
+
+// FNV-1a over the whole name (names often differ in a few chars only)
+static inline unsigned int hash_name(char *name, int len) {
+  unsigned long h = 14695981039346656037UL;
+  int i;
+  for (i=0; i<len; ++i) { h ^= (uchar)name[i]; h *= 1099511628211UL; }
+  return (unsigned int)(h ^ (h>>32));
+}
+
+
+static inline uchar *put_varint(uchar *p, unsigned long x) {
+  while (x>=128) { *p++ = (uchar)(x|128); x >>= 7; }
+  *p++ = (uchar)x;
+  return p;
+}
+
+
+static inline uchar *get_varint(uchar *p, long *x) {
+  unsigned long v=0;
+  int shift=0;
+  while (*p&128) { v |= (unsigned long)(*p++&127)<<shift; shift += 7; }
+  v |= (unsigned long)(*p++)<<shift;
+  *x = (long)v;
+  return p;
+}
+
+
+idDict *alloc_idDict(int use_hash) {
+  idDict *d = (idDict *)malloc(sizeof(idDict));
+  d->n = d->nblocks = 0;
+  d->balloc = 1024;
+  d->block = (long *)malloc(d->balloc*sizeof(long));
+  d->len = 0;
+  d->size = (1<<16);
+  d->data = (uchar *)malloc(d->size*sizeof(uchar));
+  d->maxlen = d->lastlen = 0;
+  d->bufsize = 256;
+  d->last = (char *)malloc(d->bufsize*sizeof(char));
+  d->buf = (char *)malloc(d->bufsize*sizeof(char));
+  d->hsize = 0;
+  d->hash = NULL;
+  d->mapped = 0;
+  if (use_hash) {
+    d->hsize = (1<<16);
+    d->hash = (unsigned long *)calloc(d->hsize, sizeof(unsigned long));
+  }
+  return d;
+}
+
+
+void free_idDict(idDict *d) {
+  if (d) {
+    if (!d->mapped) {
+      free(d->block);
+      free(d->data);
+      if (d->hash) free(d->hash);
+    }
+    free(d->last);
+    free(d->buf);
+    free(d);
+  }
+}
+
+
+// Insert entry (hash value and number) without checking for the name
+static inline void hash_insert(unsigned long *tab, long hsize, unsigned long entry) {
+  long k = (long)(entry>>32) & (hsize-1);
+  while (tab[k]) k = (k+1) & (hsize-1);
+  tab[k] = entry;
+}
+
+
+// Double the hash table. The hash values are in the entries
+static void grow_hash(idDict *d) {
+  unsigned long *tab;
+  long k, hsize = 2*d->hsize;
+
+  tab = (unsigned long *)calloc(hsize, sizeof(unsigned long));
+  for (k=0; k<d->hsize; ++k) if (d->hash[k]) hash_insert(tab, hsize, d->hash[k]);
+  free(d->hash);
+  d->hash = tab;
+  d->hsize = hsize;
+}
+
+
+/*
+  Add a name of length len (if len<=0 name is a string)
+  Returns the number of the name
+*/
+long add_idDict(idDict *d, char *name, int len) {
+  int prefix=0;
+  uchar *p;
+
+  if (len<=0) len = strlen(name);
+  if (d->mapped) ERROR("add_idDict: Cannot add to a mapped dictionary",1);
+  if ( d->n >= 0xffffffffL-1 ) ERROR("add_idDict: Too many names",1);
+
+  if (len+1>d->bufsize) {
+    while (len+1>d->bufsize) d->bufsize *= 2;
+    d->last = (char *)realloc(d->last, d->bufsize*sizeof(char));
+    d->buf = (char *)realloc(d->buf, d->bufsize*sizeof(char));
+  }
+  if ( d->len+len+20 > d->size ) {
+    while ( d->len+len+20 > d->size ) d->size *= 2;
+    d->data = (uchar *)realloc(d->data, d->size*sizeof(uchar));
+  }
+
+  // New block, or prefix shared with the last name
+  if ( d->n%IDDICT_BLOCK == 0 ) {
+    if (d->nblocks==d->balloc) {
+      d->balloc *= 2;
+      d->block = (long *)realloc(d->block, d->balloc*sizeof(long));
+    }
+    d->block[d->nblocks++] = d->len;
+  }
+  else while ( prefix<len && prefix<d->lastlen && name[prefix]==d->last[prefix] ) ++prefix;
+
+  p = d->data+d->len;
+  p = put_varint(p, prefix);
+  p = put_varint(p, len-prefix);
+  memcpy(p, name+prefix, len-prefix);
+  d->len = p+len-prefix-d->data;
+
+  memcpy(d->last+prefix, name+prefix, len-prefix);
+  d->lastlen = len;
+  if (len>d->maxlen) d->maxlen = len;
+
+  if (d->hash) {
+    if ( 10*(d->n+1) > 7*d->hsize ) grow_hash(d);
+    hash_insert(d->hash, d->hsize, ((unsigned long)hash_name(name,len)<<32) | (unsigned long)(d->n+1));
+  }
+
+  return d->n++;
+}
+
+
+/*
+  Write name i to name (which must have room for d->maxlen+1 chars)
+  Returns its length (-1 if there is no name i)
+*/
+int decode_idDict(idDict *d, long i, char *name) {
+  uchar *p;
+  long j, prefix, rest, len=0;
+
+  if (i<0 || i>=d->n) return -1;
+  p = d->data+d->block[i/IDDICT_BLOCK];
+  for (j=i%IDDICT_BLOCK; j>=0; --j) {
+    p = get_varint(p, &prefix);
+    p = get_varint(p, &rest);
+    memcpy(name+prefix, p, rest);
+    p += rest;
+    len = prefix+rest;
+  }
+  name[len] = '\0';
+
+  return (int)len;
+}
+
+
+// Returns name i (in a buffer that is overwritten by the next call) or NULL
+char *name_idDict(idDict *d, long i) {
+  if ( decode_idDict(d, i, d->buf) < 0 ) return NULL;
+  return d->buf;
+}
+
+
+/*
+  Returns the number of the name of length len (if len<=0 name is a
+  string), or -1 if it is not found. The dictionary must have a hash.
+*/
+long lookup_idDict(idDict *d, char *name, int len) {
+  unsigned long h;
+  long k, i;
+
+  if (!d->hash) ERROR("lookup_idDict: The dictionary has no hash",1);
+  if (len<=0) len = strlen(name);
+
+  h = hash_name(name,len);
+  k = (long)h & (d->hsize-1);
+  for ( ; d->hash[k]; k = (k+1) & (d->hsize-1) ) {
+    if ( (d->hash[k]>>32) != h ) continue;
+    i = (long)(d->hash[k] & 0xffffffffUL) - 1;
+    if ( decode_idDict(d, i, d->buf)==len && memcmp(d->buf, name, len)==0 ) return i;
+  }
+
+  return -1;
+}
+
+
+/*
+  Add the ids of all sequences in a batch (in order). If the batch was
+  read with lazy_id, the id is taken from the header line directly.
+  A sequence without id gets the empty name.
+  Returns the number of the first.
+*/
+long add_seqBatch_idDict(idDict *d, seqBatch *b) {
+  long first = d->n, *offsets;
+  char *h;
+  int i, k;
+
+  for (i=0; i<b->n; ++i) {
+    offsets = b->offsets+4*i;
+    if ( b->lazy_id && !b->seq[i].id ) {
+      if (offsets[0]<0) { add_idDict(d, "", 0); continue; }
+      h = b->arena+offsets[0];
+      for (k=0; k<offsets[1]; ++k) if ( isspace(h[k]) ) break;
+      add_idDict(d, (k?h:""), k);
+    }
+    else if (b->seq[i].id) add_idDict(d, b->seq[i].id, strlen(b->seq[i].id));
+    else add_idDict(d, "", 0);
+  }
+
+  return first;
+}
+
+
+// Bytes allocated for the dictionary
+long memory_idDict(idDict *d) {
+  return sizeof(idDict) + d->balloc*sizeof(long) + d->size + 2*d->bufsize + d->hsize*sizeof(unsigned long);
+}
+
+
+
+/*************************************************
+
+Dictionary on file
+
+  array of 4 longs: n, nblocks, maxlen and hsize
+  block offsets, data and hash table
+Each array is written with falignArrayLong and fwriteArrayLong, so it
+starts at a position divisible by 8 (as in seqDB).
+
+*************************************************/
+
+
+void write_idDict(idDict *d, FILE *fp) {
+  long head[4];
+
+  head[0] = d->n;
+  head[1] = d->nblocks;
+  head[2] = d->maxlen;
+  head[3] = d->hsize;
+  falignArrayLong(fp);
+  fwriteArrayLong(head, sizeof(long), 4, fp);
+  falignArrayLong(fp);
+  fwriteArrayLong(d->block, sizeof(long), d->nblocks, fp);
+  falignArrayLong(fp);
+  fwriteArrayLong(d->data, 1, d->len, fp);
+  falignArrayLong(fp);
+  fwriteArrayLong(d->hash, sizeof(unsigned long), d->hsize, fp);
+}
+
+
+// Point to the next array in the map and return its length in bytes
+static long array_idDict(fileBuffer *map, long *pos, char **a) {
+  long n = mapArrayLong(map->buf, map->len, pos, a);
+  if (n<0) ERROR("map_idDict: file is truncated",1);
+  return n;
+}
+
+
+/*
+  Make a dictionary from the arrays at position *pos in a mapped file
+  (written by write_idDict). pos is moved past the dictionary.
+*/
+idDict *map_idDict(fileBuffer *map, long *pos) {
+  idDict *d = (idDict *)malloc(sizeof(idDict));
+  long *head;
+  char *a;
+
+  if ( array_idDict(map, pos, &a) != 4*sizeof(long) ) ERROR("map_idDict: wrong format",1);
+  head = (long *)a;
+  d->n = head[0];
+  d->nblocks = d->balloc = head[1];
+  d->maxlen = d->lastlen = head[2];
+  d->hsize = head[3];
+  array_idDict(map, pos, &a);
+  d->block = (long *)a;
+  d->len = d->size = array_idDict(map, pos, (char **)&(d->data));
+  array_idDict(map, pos, &a);
+  d->hash = (d->hsize ? (unsigned long *)a : NULL);
+  d->bufsize = d->maxlen+1;
+  d->last = (char *)malloc(d->bufsize*sizeof(char));
+  d->buf = (char *)malloc(d->bufsize*sizeof(char));
+  d->mapped = 1;
+
+  return d;
+}
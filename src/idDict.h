@@ -0,0 +1,69 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef IDDICT_H
+#define IDDICT_H
+
+/*
+  Dictionary of sequence names
+
+  Names are numbered 0, 1, 2, ... in the order they are added, and are
+  stored front coded in blocks of IDDICT_BLOCK names: the first name of a
+  block is stored in full, and each following name as the length of the
+  prefix it shares with the name before it and the rest of the name. Read
+  names share long prefixes, so this takes a few bytes per name and there
+  is no allocation per name.
+
+  name_idDict decodes name number i (from the start of its block).
+  If the dictionary is made with a hash, lookup_idDict finds the number
+  of a name. The hash table has a 32 bit hash value and the number in
+  one long per name. A name added more than once gets a new number each
+  time, and lookup finds the first.
+
+  add_seqBatch_idDict adds the ids of a seqBatch, which is read with
+  b->lazy_id set so no id strings are made.
+
+  write_idDict writes the arrays (each starting at a position divisible
+  by 8) and map_idDict makes a dictionary pointing into a memory mapped
+  file, so it is ready at once. A mapped dictionary cannot be added to.
+
+  Include akstandard.h, simpleHash.h, fileBuffer.h and sequence.h before
+  this file.
+*/
+
+#define IDDICT_BLOCK 16
+
+typedef struct {
+  long n;                 // Number of names
+  long nblocks;
+  long balloc;
+  long *block;            // Offset in data of the first name of each block
+  long len;               // Bytes used in data
+  long size;
+  uchar *data;            // The front coded names
+  int maxlen;             // Length of the longest name
+  int lastlen;
+  int bufsize;
+  char *last;             // The last name added
+  char *buf;              // Name returned by name_idDict
+  long hsize;             // Size of hash table (a power of 2, 0 if no hash)
+  unsigned long *hash;    // hash value<<32 | (number+1), 0 if empty
+  int mapped;             // Set if the arrays point into a mapped file
+} idDict;
+
+
+idDict *alloc_idDict(int use_hash);
+void free_idDict(idDict *d);
+long add_idDict(idDict *d, char *name, int len);
+int decode_idDict(idDict *d, long i, char *name);
+char *name_idDict(idDict *d, long i);
+long lookup_idDict(idDict *d, char *name, int len);
+long add_seqBatch_idDict(idDict *d, seqBatch *b);
+long memory_idDict(idDict *d);
+void write_idDict(idDict *d, FILE *fp);
+idDict *map_idDict(fileBuffer *map, long *pos);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  2 bit packed DNA
+
+  Example (seq read with a DNA alphabet):
+
+  packedDNA *p = pack_Sequence(seq,alph);
+  free_Sequence(seq);
+  ...
+  revcomp_packedDNA(p,alph);
+  n = kmers_packedDNA(p, 21, 0, p->len, kmers, NULL);
+  ...
+  seq = unpack_packedDNA(p);
+  free_packedDNA(p);
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "akstandard.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "sequence.h"
+#include "packedDNA.h"
+
+
+packedDNA *alloc_packedDNA(long len) {
+  packedDNA *p = (packedDNA *)malloc(sizeof(packedDNA));
+  p->id = p->descr = NULL;
+  p->flag = 0;
+  p->len = len;
+  p->nwords = (len+31)/32;
+  p->w = (packedWord *)calloc(p->nwords+1, sizeof(packedWord));
+  p->nexc = p->nalloc = 0;
+  p->exc_pos = p->exc_len = NULL;
+  p->exc_code = NULL;
+  return p;
+}
+
+
+void free_packedDNA(packedDNA *p) {
+  if (p) {
+    if (p->id) free(p->id);
+    if (p->descr) free(p->descr);
+    free(p->w);
+    if (p->exc_pos) { free(p->exc_pos); free(p->exc_len); free(p->exc_code); }
+    free(p);
+  }
+}
+
+
+// Add base i with number c to the exceptions (extending the last run if possible)
+static void add_exception(packedDNA *p, long i, char c) {
+  int n = p->nexc;
+  if ( n>0 && p->exc_code[n-1]==c && p->exc_pos[n-1]+p->exc_len[n-1]==i ) {
+    p->exc_len[n-1] += 1;
+    return;
+  }
+  if (n==p->nalloc) {
+    p->nalloc = (p->nalloc ? 2*p->nalloc : 16);
+    p->exc_pos = (long *)realloc(p->exc_pos, p->nalloc*sizeof(long));
+    p->exc_len = (long *)realloc(p->exc_len, p->nalloc*sizeof(long));
+    p->exc_code = (char *)realloc(p->exc_code, p->nalloc*sizeof(char));
+  }
+  p->exc_pos[n] = i;
+  p->exc_len[n] = 1;
+  p->exc_code[n] = c;
+  p->nexc += 1;
+}
+
+
+/*
+  Pack a sequence translated with a DNA or RNA alphabet from
+  bio_AlphabetStruct. id and descr are copied, the sequence is not changed.
+*/
+packedDNA *pack_Sequence(Sequence *seq, AlphabetStruct *alph) {
+  packedDNA *p;
+  packedWord x;
+  long i, j, n;
+  int c;
+
+  if ( !AlphabetStruct_test_flag(alph,AS_DNA) && !AlphabetStruct_test_flag(alph,AS_RNA) )
+    ERROR("pack_Sequence: alphabet must be DNA or RNA",1);
+
+  p = alloc_packedDNA(seq->len);
+  if (seq->id) p->id = strdup(seq->id);
+  if (seq->descr) p->descr = strdup(seq->descr);
+  p->flag = seq->flag & 3;
+
+  for (j=0, i=0; j<p->nwords; ++j) {
+    n = MINIMUM(32, seq->len-i);
+    x = 0;
+    for ( ; n>0; --n, ++i) {
+      c = seq->s[i]-1;
+      if ( c<0 || c>3 ) { add_exception(p, i, seq->s[i]); c=0; }
+      x = (x<<2) | c;
+    }
+    p->w[j] = x << (64-2*MINIMUM(32, seq->len-32*j));
+  }
+
+  return p;
+}
+
+
+/*
+  Unpack n bases from position from into dest (which must have room
+  for n chars), so dest holds the numbers as in Sequence->s
+*/
+void unpack_region_packedDNA(packedDNA *p, long from, long n, char *dest) {
+  long i, to=from+n, e, a, b;
+  packedWord x;
+  int k;
+
+  // Bases until a word boundary
+  for (i=from; i<to && (i&31); ++i) *dest++ = base_packedDNA(p,i);
+  // One word (32 bases) at a time
+  for ( ; i+32<=to; i+=32, dest+=32) {
+    x = p->w[i>>5];
+    for (k=0; k<32; ++k) dest[k] = 1 + (char)( (x>>(62-2*k)) & 3 );
+  }
+  for ( ; i<to; ++i) *dest++ = base_packedDNA(p,i);
+
+  // Exceptions overlapping the region
+  dest -= n;
+  for (e=0; e<p->nexc; ++e) {
+    a = MAXIMUM(from, p->exc_pos[e]);
+    b = MINIMUM(to, p->exc_pos[e]+p->exc_len[e]);
+    if (a<b) memset(dest+a-from, p->exc_code[e], b-a);
+  }
+}
+
+
+// Returns a Sequence with allocated id, descr and s
+Sequence *unpack_packedDNA(packedDNA *p) {
+  Sequence *seq = alloc_Sequence();
+
+  if (p->id) { seq->id = strdup(p->id); setBit(seq->flag,seq_flag_id); }
+  if (p->descr) { seq->descr = strdup(p->descr); setBit(seq->flag,seq_flag_descr); }
+  seq->flag |= p->flag & 3;
+  seq->len = p->len;
+  seq->s = (char *)malloc((p->len+1)*sizeof(char));
+  setBit(seq->flag,seq_flag_seq);
+  unpack_region_packedDNA(p, 0, p->len, seq->s);
+  seq->s[p->len] = 0;
+
+  return seq;
+}
+
+
+/*
+  Reverse complement in place
+
+  Each word is complemented and reversed, the order of the words is
+  reversed, and finally everything is shifted to remove the padding at the
+  end of the last word. The alphabet is used to complement the exceptions.
+*/
+void revcomp_packedDNA(packedDNA *p, AlphabetStruct *alph) {
+  long i, j, pad;
+  packedWord x;
+  int s;
+  char c;
+
+  if (p->len==0) return;
+
+  for (i=0, j=p->nwords-1; i<=j; ++i, --j) {
+    x = revcomp_kmer(p->w[i],32);
+    p->w[i] = revcomp_kmer(p->w[j],32);
+    p->w[j] = x;
+  }
+
+  pad = 32*p->nwords - p->len;
+  if (pad>0) {
+    s = 2*pad;
+    for (i=0; i<p->nwords-1; ++i) p->w[i] = (p->w[i]<<s) | (p->w[i+1]>>(64-s));
+    p->w[i] <<= s;
+  }
+
+  for (i=0, j=p->nexc-1; i<=j; ++i, --j) {
+    x = p->exc_pos[i];
+    p->exc_pos[i] = p->len - p->exc_pos[j] - p->exc_len[j];
+    p->exc_pos[j] = p->len - x - p->exc_len[i];
+    x = p->exc_len[i]; p->exc_len[i] = p->exc_len[j]; p->exc_len[j] = x;
+    c = p->exc_code[i]; p->exc_code[i] = p->exc_code[j]; p->exc_code[j] = c;
+  }
+  if (alph->compTrans)
+    for (i=0; i<p->nexc; ++i)
+      if ( p->exc_code[i]>=0 && p->exc_code[i]<alph->len ) p->exc_code[i] = alph->compTrans[(int)p->exc_code[i]];
+
+  toggleBit(p->flag,seq_flag_rev);
+  toggleBit(p->flag,seq_flag_comp);
+}
+
+
+/*
+  Find all kmers (k<=32) starting at positions from to to-1 that do not
+  contain exceptions. They are written to kmers and their positions to pos
+  (if pos!=NULL); both must have room for to-from entries.
+  Returns the number of kmers found.
+
+  The kmers are rolled along the packed words, so each base is only read
+  once (apart from the first kmer after an exception).
+*/
+long kmers_packedDNA(packedDNA *p, int k, long from, long to, packedWord *kmers, long *pos) {
+  const packedWord mask = (k==32 ? ~(packedWord)0 : (((packedWord)1)<<(2*k))-1);
+  long i, a, b, n=0;
+  packedWord x, word;
+  int e=0;
+
+  if (k<1 || k>32) ERROR("kmers_packedDNA: k must be between 1 and 32",1);
+  if (to > p->len-k+1) to = p->len-k+1;
+
+  while (from<to) {
+    // Skip exceptions ending before from
+    while ( e<p->nexc && p->exc_pos[e]+p->exc_len[e]<=from ) ++e;
+    // Clean stretch [a,b[ of bases
+    a = from;
+    if ( e<p->nexc && p->exc_pos[e]<=a ) { from = p->exc_pos[e]+p->exc_len[e]; continue; }
+    b = ( e<p->nexc ? p->exc_pos[e] : p->len );
+    if (b-a<k) { from = b; continue; }
+
+    x = kmer_packedDNA(p, a, k);
+    kmers[n] = x;
+    if (pos) pos[n] = a;
+    ++n;
+    i = a+k;
+    word = p->w[i>>5] << (2*(i&31));
+    for ( ; i<b && i-k+1<to; ++i) {
+      if ( (i&31)==0 ) word = p->w[i>>5];
+      x = ( (x<<2) | (word>>62) ) & mask;
+      word <<= 2;
+      kmers[n] = x;
+      if (pos) pos[n] = i-k+1;
+      ++n;
+    }
+    from = b;
+  }
+
+  return n;
+}
@@ -0,0 +1,74 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef PACKEDDNA_H
+#define PACKEDDNA_H
+
+/*
+  DNA sequences packed with 2 bits per base
+
+  Works with the DNA and RNA alphabets from bio_AlphabetStruct, where
+  A, C, G and T/U are numbers 1-4. These are stored as 0-3 in 64 bit
+  words with 32 bases per word, first base in the most significant bits.
+  All other numbers (N, IUPAC codes, lower case letters in case sensitive
+  alphabets, etc.) are kept in a list of exceptions, where each entry is
+  a run of identical numbers. In the packed words they are stored as 0.
+
+  A kmer (k<=32) is a number with 2 bits per base and the first base in
+  the most significant bits (so A..A=0 and T..T=4^k-1).
+
+  Include akstandard.h, simpleHash.h, fileBuffer.h and sequence.h before this file.
+*/
+
+typedef unsigned long long packedWord;
+
+typedef struct {
+  char *id;
+  char *descr;
+  uchar flag;        // Only seq_flag_rev and seq_flag_comp are used
+  long len;          // Number of bases
+  long nwords;
+  packedWord *w;     // Bases packed in words
+  int nexc;          // Number of exception runs
+  int nalloc;        // Allocated length of exception arrays
+  long *exc_pos;     // Start of run
+  long *exc_len;     // Length of run
+  char *exc_code;    // The number (as in Sequence->s) of all bases in run
+} packedDNA;
+
+
+// Number of base i ignoring exceptions (1-4)
+static inline int base_packedDNA(packedDNA *p, long i) {
+  return 1 + (int)( (p->w[i>>5] >> (62-2*(i&31))) & 3 );
+}
+
+// Kmer starting at pos (k<=32 and pos+k<=len). Exceptions are ignored
+static inline packedWord kmer_packedDNA(packedDNA *p, long pos, int k) {
+  int off = 2*(pos&31);
+  packedWord x = p->w[pos>>5] << off;
+  if ( off>0 && off+2*k>64 ) x |= p->w[(pos>>5)+1] >> (64-off);
+  return x >> (64-2*k);
+}
+
+// Reverse complement of a kmer
+static inline packedWord revcomp_kmer(packedWord x, int k) {
+  x = ~x;
+  x = ((x>>2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL)<<2);
+  x = ((x>>4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL)<<4);
+  x = __builtin_bswap64(x);
+  return x >> (64-2*k);
+}
+
+
+packedDNA *alloc_packedDNA(long len);
+void free_packedDNA(packedDNA *p);
+packedDNA *pack_Sequence(Sequence *seq, AlphabetStruct *alph);
+void unpack_region_packedDNA(packedDNA *p, long from, long n, char *dest);
+Sequence *unpack_packedDNA(packedDNA *p);
+void revcomp_packedDNA(packedDNA *p, AlphabetStruct *alph);
+long kmers_packedDNA(packedDNA *p, int k, long from, long to, packedWord *kmers, long *pos);
+
+#endif
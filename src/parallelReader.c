@@ -0,0 +1,595 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+
+/*
+  Parallel parsing of fasta and fastq files
+
+  The master reads chunks of chunk_size bytes and cuts each chunk after
+  the last record start found in it. The rest is put in front of the next
+  chunk. Each chunk is parsed by an inThreads worker using the fileBuffer
+  readers, and since inThreads returns jobs in the order they were queued,
+  the sequences come out in file order.
+
+  For fastq a line starting with '@' is only taken as a record start if
+  the line after the next starts with '+' (a quality line can start with
+  '@'). This assumes the usual four-line records.
+
+  Example:
+
+  parallelReader *pr = alloc_parallelReader(fp,'@',dna,qual,0,8,0);
+  while ( (seq=readSequence_parallelReader(pr)) ) {
+    ...
+    free_Sequence(seq);
+  }
+  free_parallelReader(pr);
+
+  fp must be at the beginning of the file (or at the start of a record).
+  If pr->stats is set (before the first read), all sequences are counted
+  in it (see seqStats in sequence.h). It is complete when the end of the
+  file has been reached. With pr->stats->keep_counts set, each sequence
+  has its own counts in seq->counts.
+  next_chunk_parallelReader returns all the sequences of a chunk as a
+  linked list (in seq->next), which can be freed with free_Sequence_list.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inThreads.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "sequence.h"
+#include "bgzf.h"
+#include "parallelReader.h"
+
+
+typedef struct {
+  char *data;
+  long len;
+  parallelReader *pr;
+  Sequence *first;     // Sequences parsed (linked list)
+  int nseq;
+} chunkJob;
+
+
+/*
+  Returns the position of the last record start in buf[0..n[ that can be
+  recognized, or 0 if none is found (also used by seqIndex)
+*/
+long last_record_start(char *buf, long n, int type) {
+  long p=n;
+  char *l1, *l2;
+
+  while ( p>0 ) {
+    // Go to the beginning of the line before p
+    --p;
+    while ( p>0 && buf[p-1]!='\n' ) --p;
+    if ( p==0 || buf[p]!=type ) continue;
+    if ( type=='>' ) return p;
+    // Fastq: line after the next must start with '+'
+    l1 = (char *)memchr(buf+p, '\n', n-p);
+    if (!l1) continue;
+    l2 = (char *)memchr(l1+1, '\n', buf+n-l1-1);
+    if ( l2 && l2+1<buf+n && l2[1]=='+' ) return p;
+  }
+  return 0;
+}
+
+
+/*
+  Read a chunk from the file and cut it after the last record start
+  Returns NULL when the file is exhausted
+*/
+static chunkJob *read_chunk(parallelReader *pr) {
+  long n, r, split, alloc;
+  char *buf;
+  chunkJob *job;
+
+  if (pr->eof && pr->nrest==0) return NULL;
+
+  alloc = pr->nrest+pr->chunk_size;
+  buf = (char *)malloc(alloc*sizeof(char));
+  n = pr->nrest;
+  if (pr->rest) { memcpy(buf, pr->rest, n); free(pr->rest); pr->rest=NULL; }
+  pr->nrest = 0;
+
+  while ( 1 ) {
+    if (!pr->eof) {
+      if (alloc-n < pr->chunk_size) {
+	alloc = n+pr->chunk_size;
+	buf = (char *)realloc(buf, alloc*sizeof(char));
+      }
+      r = fread(buf+n, 1, pr->chunk_size, pr->fp);
+      n += r;
+      if (r<pr->chunk_size) pr->eof=1;
+    }
+    if (pr->eof) { split = n; break; }
+    // If no record start is found, the chunk is extended
+    if ( (split = last_record_start(buf, n, pr->type)) > 0 ) break;
+  }
+
+  if (split<n) {
+    pr->nrest = n-split;
+    pr->rest = (char *)malloc(pr->nrest*sizeof(char));
+    memcpy(pr->rest, buf+split, pr->nrest);
+  }
+
+  job = (chunkJob *)malloc(sizeof(chunkJob));
+  job->data = buf;
+  job->len = split;
+  job->pr = pr;
+  job->first = NULL;
+  job->nseq = 0;
+
+  return job;
+}
+
+
+// Worker function parsing a chunk
+static int parse_chunk(int thread, void *x) {
+  chunkJob *job = (chunkJob *)x;
+  parallelReader *pr = job->pr;
+  fileBuffer *fb = memory_fileBuffer(job->data, job->len, 0);
+  Sequence *seq, *last=NULL;
+  seqStats stats, *st=NULL;
+
+  // Counted locally and merged when the chunk is done
+  if (pr->stats) {
+    st = &stats;
+    init_seqStats(st, pr->seq_alph);
+    st->keep_counts = pr->stats->keep_counts;
+  }
+
+  if ( ReadSequenceFileHeader_fileBuffer(fb, pr->type) ) {
+    while ( 1 ) {
+      if (pr->type=='@') seq = readFastqStats_fileBuffer(fb, pr->seq_alph, pr->qual_alph, pr->save_descr, st);
+      else seq = readFastaStats_fileBuffer(fb, pr->seq_alph, pr->save_descr, st);
+      if (!seq) break;
+      if (last) last->next = seq;
+      else job->first = seq;
+      last = seq;
+      job->nseq += 1;
+    }
+  }
+
+  if (st) merge_seqStats(pr->stats, st);
+  free_fileBuffer(fb);
+  free(job->data);
+  job->data = NULL;
+
+  return 0;
+}
+
+
+// Keep max_jobs chunks in the queue
+static void queue_chunks(parallelReader *pr) {
+  chunkJob *job;
+  while ( pr->jobs < pr->max_jobs && (job=read_chunk(pr)) ) {
+    new_job_inThreads(pr->threads, (void *)job);
+    pr->jobs += 1;
+  }
+  if ( pr->eof && pr->nrest==0 && !pr->threads->no_more_jobs ) finished_jobqueue_inThreads(pr->threads);
+}
+
+
+// Wait for the next chunk to finish (assumes that there is one)
+static chunkJob *wait_chunk(parallelReader *pr) {
+  chunkJob *job;
+  while ( !(job=(chunkJob *)next_output_inThreads(pr->threads)) ) millisleep(pr->threads->sleep);
+  pr->jobs -= 1;
+  return job;
+}
+
+
+/*
+  chunk_size<=0 gives a default size of 16MB
+*/
+parallelReader *alloc_parallelReader(FILE *fp, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+				     int save_descr, int nthreads, long chunk_size) {
+  parallelReader *pr = (parallelReader *)malloc(sizeof(parallelReader));
+
+  if ( type!='>' && type!='@' ) ERROR("alloc_parallelReader: type must be '>' or '@'",1);
+  if (nthreads<1) nthreads=1;
+  if (chunk_size<=0) chunk_size = (1<<24);
+
+  pr->fp = fp;
+  pr->type = type;
+  pr->seq_alph = seq_alph;
+  pr->qual_alph = qual_alph;
+  pr->save_descr = save_descr;
+  pr->chunk_size = chunk_size;
+  pr->max_jobs = 2*nthreads;
+  pr->jobs = 0;
+  pr->eof = 0;
+  pr->rest = NULL;
+  pr->nrest = 0;
+  pr->current = NULL;
+  pr->stats = NULL;
+
+  pr->threads = init_inThreads(nthreads, parse_chunk);
+  start_inThreads(pr->threads);
+
+  return pr;
+}
+
+
+/*
+  Returns the sequences of the next chunk as a linked list (in seq->next)
+  and the number of sequences in *nseq (if nseq!=NULL). The list is
+  freed with free_Sequence_list. Returns NULL at the end of the file.
+*/
+Sequence *next_chunk_parallelReader(parallelReader *pr, int *nseq) {
+  chunkJob *job;
+  Sequence *first=NULL;
+  int n=0;
+
+  while (!first) {
+    queue_chunks(pr);
+    if (pr->jobs==0) break;
+    job = wait_chunk(pr);
+    first = job->first;
+    n = job->nseq;
+    free(job);
+  }
+  if (nseq) *nseq = n;
+
+  return first;
+}
+
+
+// Returns the next sequence (like readFastq/readFasta). NULL at the end.
+Sequence *readSequence_parallelReader(parallelReader *pr) {
+  Sequence *seq;
+  if (!pr->current) pr->current = next_chunk_parallelReader(pr, NULL);
+  seq = pr->current;
+  if (seq) {
+    pr->current = seq->next;
+    seq->next = NULL;
+  }
+  return seq;
+}
+
+
+// Sequences not yet returned are freed. The file is not closed.
+void free_parallelReader(parallelReader *pr) {
+  chunkJob *job;
+
+  if (!pr->threads->no_more_jobs) finished_jobqueue_inThreads(pr->threads);
+  while ( pr->jobs>0 ) {
+    job = wait_chunk(pr);
+    free_Sequence_list(job->first);
+    free(job);
+  }
+  free_Sequence_list(pr->current);
+  cleanup_inThreads(pr->threads);
+  if (pr->rest) free(pr->rest);
+  free(pr);
+}
+
+
+
+
+/*************************************************
+
+Paired-end reading
+
+Example:
+
+  pairedReader *pr = alloc_pairedReader(fp1,fp2,dna,qual,0,0);
+  while ( (pb=next_pairedReader(pr)) ) {
+    for (i=0; i<pb->n; ++i) {
+      r1 = pb->mate[0]->seq+i;
+      r2 = pb->mate[1]->seq+i;
+      ...
+    }
+  }
+  free_pairedReader(pr);
+
+A batch is valid until the next call to next_pairedReader, so it can be
+split into jobs for inThreads workers and collected before the next call.
+It is an error if the files have different numbers of reads or if the
+ids of two mates do not match.
+
+*************************************************/
+
+
+typedef struct {
+  fileBuffer *fb;
+  seqBatch *b;
+  pairedReader *pr;
+} mateJob;
+
+
+// Worker function reading a batch of one mate
+static int read_mates(int thread, void *x) {
+  mateJob *job = (mateJob *)x;
+  pairedReader *pr = job->pr;
+  read_seqBatch(job->b, job->fb, '@', pr->seq_alph, pr->qual_alph, pr->save_descr, pr->batch_size, 0);
+  return 0;
+}
+
+
+/*
+  Returns 1 if the ids are the same, or if they are the same except for a
+  final "/1" in id1 and "/2" in id2 (as in "read7/1" and "read7/2").
+  Newer Illumina ids are the same for both mates (the mate number is in
+  the description).
+*/
+int same_mate_id(char *id1, char *id2) {
+  long l1, l2;
+
+  if (!id1) id1="";
+  if (!id2) id2="";
+  if ( strcmp(id1,id2)==0 ) return 1;
+  l1 = strlen(id1);
+  l2 = strlen(id2);
+  if ( l1!=l2 || l1<2 ) return 0;
+  if ( id1[l1-2]!='/' || id1[l1-1]!='1' || id2[l2-2]!='/' || id2[l2-1]!='2' ) return 0;
+  return ( strncmp(id1,id2,l1-2)==0 );
+}
+
+
+// Start reading batch[pr->next]
+static void queue_pairedReader(pairedReader *pr) {
+  mateJob *job;
+  int m;
+
+  for (m=0; m<2; ++m) {
+    job = (mateJob *)malloc(sizeof(mateJob));
+    job->fb = pr->fb[m];
+    job->b = pr->batch[pr->next].mate[m];
+    job->pr = pr;
+    new_job_inThreads(pr->threads, (void *)job);
+  }
+  pr->reading = 1;
+}
+
+
+// Wait for both mates of batch[pr->next]
+static void wait_pairedReader(pairedReader *pr) {
+  mateJob *job;
+  int m;
+
+  for (m=0; m<2; ++m) {
+    while ( !(job=(mateJob *)next_output_inThreads(pr->threads)) ) millisleep(pr->threads->sleep);
+    free(job);
+  }
+  pr->reading = 0;
+}
+
+
+/*
+  fp1 and fp2 are the R1 and R2 files, which must be at the beginning (or
+  at the start of a record). batch_size<=0 gives 16384 pairs.
+*/
+pairedReader *alloc_pairedReader(FILE *fp1, FILE *fp2, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+				 int save_descr, int batch_size) {
+  pairedReader *pr = (pairedReader *)malloc(sizeof(pairedReader));
+  int i, m;
+
+  if (batch_size<=0) batch_size = (1<<14);
+
+  pr->fb[0] = alloc_fileBuffer(fp1, 0);
+  pr->fb[1] = alloc_fileBuffer(fp2, 0);
+  pr->seq_alph = seq_alph;
+  pr->qual_alph = qual_alph;
+  pr->save_descr = save_descr;
+  pr->batch_size = batch_size;
+  for (i=0; i<2; ++i) {
+    pr->batch[i].n = 0;
+    for (m=0; m<2; ++m) pr->batch[i].mate[m] = alloc_seqBatch();
+  }
+  pr->next = 0;
+  pr->reading = 0;
+  for (i=0, m=0; m<2; ++m) i += ( ReadSequenceFileHeader_fileBuffer(pr->fb[m],'@')!=0 );
+  if (i==1) ERROR("alloc_pairedReader: One of the files is empty",1);
+  pr->eof = (i==0);
+
+  pr->threads = init_inThreads(2, read_mates);
+  start_inThreads(pr->threads);
+  if (!pr->eof) queue_pairedReader(pr);
+
+  return pr;
+}
+
+
+/*
+  Returns the next batch of pairs (NULL at the end of the files).
+  The batch is valid until the next call.
+*/
+pairedBatch *next_pairedReader(pairedReader *pr) {
+  pairedBatch *pb;
+  Sequence *s1, *s2;
+  int i;
+
+  if (!pr->reading) return NULL;
+  wait_pairedReader(pr);
+
+  pb = pr->batch+pr->next;
+  if ( pb->mate[0]->n != pb->mate[1]->n ) ERROR("next_pairedReader: The files have different numbers of reads",1);
+  pb->n = pb->mate[0]->n;
+  for (i=0; i<pb->n; ++i) {
+    s1 = pb->mate[0]->seq+i;
+    s2 = pb->mate[1]->seq+i;
+    if ( !same_mate_id(id_seqBatch(pb->mate[0],i),id_seqBatch(pb->mate[1],i)) ) {
+      fprintf(stderr,"Mates %s and %s\n", (s1->id?s1->id:""), (s2->id?s2->id:""));
+      ERROR("next_pairedReader: The ids of mates do not match",1);
+    }
+  }
+
+  // Read the next batch while this one is used
+  if (pb->n<pr->batch_size) pr->eof = 1;
+  pr->next = 1-pr->next;
+  if (!pr->eof) queue_pairedReader(pr);
+
+  if (pb->n==0) return NULL;
+  return pb;
+}
+
+
+// The files are not closed
+void free_pairedReader(pairedReader *pr) {
+  int i, m;
+
+  if (pr->reading) wait_pairedReader(pr);
+  finished_jobqueue_inThreads(pr->threads);
+  cleanup_inThreads(pr->threads);
+  for (i=0; i<2; ++i) for (m=0; m<2; ++m) free_seqBatch(pr->batch[i].mate[m]);
+  for (m=0; m<2; ++m) free_fileBuffer(pr->fb[m]);
+  free(pr);
+}
+
+
+
+
+/*************************************************
+
+Reading many files
+
+Example:
+
+  multiReader *mr = alloc_multiReader(files,nfiles,0,dna,qual,0,8);
+  while ( (seq=next_file_multiReader(mr,&f,&n)) ) {
+    // seq is a list of the n sequences of files[f]
+    ...
+    free_Sequence_list(seq);
+  }
+  free_multiReader(mr);
+
+Each file is a job for an inThreads worker, which reads all of it with
+its own seqReader, so many small files (e.g. one per sample) are read in
+parallel. Compressed files are read with gzip_fileBuffer. The files are
+returned in the order given.
+
+*************************************************/
+
+
+typedef struct {
+  int file;
+  multiReader *mr;
+  Sequence *first;
+  int nseq;
+} fileJob;
+
+
+// Worker function reading a whole file
+static int read_file_job(int thread, void *x) {
+  fileJob *job = (fileJob *)x;
+  multiReader *mr = job->mr;
+  FILE *fp = open_file_read(mr->files[job->file], NULL, "sequence file");
+  // The files are already read in parallel, so BGZF is inflated without threads
+  seqReader *r = alloc_seqReader(gzip_fileBuffer(fp,0,0), mr->type, mr->seq_alph, mr->qual_alph, mr->save_descr);
+  Sequence *seq, *last=NULL;
+  seqStats stats;
+
+  if (mr->stats) {
+    r->stats = &stats;
+    init_seqStats(&stats, mr->seq_alph);
+    stats.keep_counts = mr->stats->keep_counts;
+  }
+  while ( (seq=read_seqReader(r)) ) {
+    if (last) last->next = seq;
+    else job->first = seq;
+    last = seq;
+    job->nseq += 1;
+  }
+  if (mr->stats) merge_seqStats(mr->stats, &stats);
+
+  free_seqReader(r);
+  fclose(fp);
+
+  return 0;
+}
+
+
+// Keep max_jobs files in the queue
+static void queue_files(multiReader *mr) {
+  fileJob *job;
+  while ( mr->jobs < mr->max_jobs && mr->next < mr->nfiles ) {
+    job = (fileJob *)malloc(sizeof(fileJob));
+    job->file = mr->next++;
+    job->mr = mr;
+    job->first = NULL;
+    job->nseq = 0;
+    new_job_inThreads(mr->threads, (void *)job);
+    mr->jobs += 1;
+  }
+  if ( mr->next==mr->nfiles && !mr->threads->no_more_jobs ) finished_jobqueue_inThreads(mr->threads);
+}
+
+
+/*
+  The file names are not copied. type is '>', '@' or 0 (found for each
+  file). If mr->stats is set before the first read, all sequences are
+  counted in it (and in seq->counts with mr->stats->keep_counts).
+*/
+multiReader *alloc_multiReader(char **files, int nfiles, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+			       int save_descr, int nthreads) {
+  multiReader *mr = (multiReader *)malloc(sizeof(multiReader));
+
+  if ( type!=0 && type!='>' && type!='@' ) ERROR("alloc_multiReader: type must be '>', '@' or 0",1);
+  if (nthreads<1) nthreads=1;
+
+  mr->files = files;
+  mr->nfiles = nfiles;
+  mr->type = type;
+  mr->seq_alph = seq_alph;
+  mr->qual_alph = qual_alph;
+  mr->save_descr = save_descr;
+  mr->max_jobs = 2*nthreads;
+  mr->jobs = 0;
+  mr->next = 0;
+  mr->stats = NULL;
+
+  mr->threads = init_inThreads(nthreads, read_file_job);
+  start_inThreads(mr->threads);
+
+  return mr;
+}
+
+
+/*
+  Returns the sequences of the next file as a linked list (in seq->next),
+  which is freed with free_Sequence_list. The number of the file is put
+  in *file and the number of sequences in *nseq (if not NULL). Empty
+  files are skipped. Returns NULL at the end.
+*/
+Sequence *next_file_multiReader(multiReader *mr, int *file, int *nseq) {
+  fileJob *job;
+  Sequence *first=NULL;
+
+  while (!first) {
+    queue_files(mr);
+    if (mr->jobs==0) break;
+    while ( !(job=(fileJob *)next_output_inThreads(mr->threads)) ) millisleep(mr->threads->sleep);
+    mr->jobs -= 1;
+    first = job->first;
+    if (file) *file = job->file;
+    if (nseq) *nseq = job->nseq;
+    free(job);
+  }
+
+  return first;
+}
+
+
+// Files not yet returned are read and freed
+void free_multiReader(multiReader *mr) {
+  fileJob *job;
+
+  mr->next = mr->nfiles;
+  if (!mr->threads->no_more_jobs) finished_jobqueue_inThreads(mr->threads);
+  while ( mr->jobs>0 ) {
+    while ( !(job=(fileJob *)next_output_inThreads(mr->threads)) ) millisleep(mr->threads->sleep);
+    mr->jobs -= 1;
+    free_Sequence_list(job->first);
+    free(job);
+  }
+  cleanup_inThreads(mr->threads);
+  free(mr);
+}
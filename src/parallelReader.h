@@ -0,0 +1,98 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef PARALLELREADER_H
+#define PARALLELREADER_H
+
+/*
+  Reading fasta or fastq files in parallel
+
+  The input is read in large chunks that are cut at record starts. The
+  chunks are parsed by inThreads workers and the sequences are returned
+  in file order.
+
+  pairedReader reads paired-end fastq files (R1 and R2) in batches. The two
+  files are parsed at the same time by two inThreads workers, and the next
+  batch is parsed while the current one is used. The ids of all mates are
+  checked (see same_mate_id).
+
+  multiReader reads a list of files (e.g. one per sample), where each file
+  is read by one inThreads worker with its own seqReader.
+
+  Include akstandard.h (or inThreads.h), simpleHash.h, fileBuffer.h and
+  sequence.h before this file.
+*/
+typedef struct {
+  FILE *fp;
+  int type;                   // '>' for fasta or '@' for fastq
+  AlphabetStruct *seq_alph;
+  AlphabetStruct *qual_alph;
+  int save_descr;
+  long chunk_size;            // Number of bytes read for each chunk
+  int max_jobs;               // Max number of chunks being parsed at a time
+  int jobs;                   // Number of chunks being parsed
+  int eof;                    // Set when all of fp has been read
+  char *rest;                 // Data after the last record start of previous chunk
+  long nrest;
+  Sequence *current;          // Sequences of current chunk not yet returned
+  seqStats *stats;            // If set, sequences are counted here
+  inThreads *threads;
+} parallelReader;
+
+
+// Sequence i of mate[0] and of mate[1] is a pair
+typedef struct {
+  int n;                      // Number of pairs
+  seqBatch *mate[2];
+} pairedBatch;
+
+
+typedef struct {
+  fileBuffer *fb[2];
+  AlphabetStruct *seq_alph;
+  AlphabetStruct *qual_alph;
+  int save_descr;
+  int batch_size;             // Max number of pairs in a batch
+  pairedBatch batch[2];       // Batch returned and batch being read
+  int next;                   // The batch being read
+  int reading;                // Set if batch[next] is being read
+  int eof;
+  inThreads *threads;
+} pairedReader;
+
+
+typedef struct {
+  char **files;
+  int nfiles;
+  int type;                   // '>', '@' or 0 (found for each file)
+  AlphabetStruct *seq_alph;
+  AlphabetStruct *qual_alph;
+  int save_descr;
+  int max_jobs;               // Max number of files being read at a time
+  int jobs;                   // Number of files being read
+  int next;                   // Next file to queue
+  seqStats *stats;            // If set, sequences are counted here
+  inThreads *threads;
+} multiReader;
+
+
+long last_record_start(char *buf, long n, int type);
+parallelReader *alloc_parallelReader(FILE *fp, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+				     int save_descr, int nthreads, long chunk_size);
+Sequence *next_chunk_parallelReader(parallelReader *pr, int *nseq);
+Sequence *readSequence_parallelReader(parallelReader *pr);
+void free_parallelReader(parallelReader *pr);
+int same_mate_id(char *id1, char *id2);
+pairedReader *alloc_pairedReader(FILE *fp1, FILE *fp2, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+				 int save_descr, int batch_size);
+pairedBatch *next_pairedReader(pairedReader *pr);
+void free_pairedReader(pairedReader *pr);
+multiReader *alloc_multiReader(char **files, int nfiles, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+			       int save_descr, int nthreads);
+Sequence *next_file_multiReader(multiReader *mr, int *file, int *nseq);
+void free_multiReader(multiReader *mr);
+
+#endif
@@ -0,0 +1,441 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  Quality trimming and filtering (see qualityFilter.h)
+
+  Example (Sanger/Illumina 1.8 qualities with offset 33):
+
+  qf = alloc_qualityFilter(dna, qual, 33);
+  qf->window = 4;
+  qf->window_q = 20;
+  qf->min_len = 36;
+  qf->max_n = 2;
+  while ( (seq=readFastq_filter(fb,dna,qual,1,qf)) ) {
+    ...
+    free_Sequence(seq);
+  }
+  free(qf);
+
+  or on a batch: read_seqBatch(...) followed by filter_seqBatch(b,qf).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "akstandard.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "simdKernels.h"
+#include "sequence.h"
+#include "qualityFilter.h"
+
+
+/*
+  phred_offset is the ascii value of phred score 0 (33 or 64), which must
+  be in qual_alph. seq_alph can be NULL if N's are not counted.
+*/
+qualityFilter *alloc_qualityFilter(AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int phred_offset) {
+  qualityFilter *qf = (qualityFilter *)calloc(1,sizeof(qualityFilter));
+
+  qf->qzero = qual_alph->trans[phred_offset];
+  if ( qual_alph->a[qf->qzero]!=phred_offset ) ERROR("alloc_qualityFilter: phred score 0 is not in quality alphabet",1);
+  qf->ncode = -1;
+  if ( seq_alph && seq_alph->trans['N']>0 ) qf->ncode = seq_alph->trans['N'];
+  qf->max_n = -1;
+
+  return qf;
+}
+
+
+/*
+  Length of q before the first window of length w with mean quality
+  below minq (n if there is none). If n<w the whole read is one window.
+*/
+static long window_cut(char *q, long n, int w, int minq) {
+  long i, sum=0, minsum;
+
+  if (n<w) w=n;
+  minsum = (long)w*minq;
+  for (i=0; i<w; ++i) sum += q[i];
+  if (sum<minsum) return 0;
+  for (i=w; i<n; ++i) {
+    sum += q[i]-q[i-w];
+    if (sum<minsum) return i-w+1;
+  }
+  return n;
+}
+
+
+// Number of residues with code ncode (the N's) among the first len of s
+static long count_ncode(char *s, long len, int ncode) {
+  long counts[128];
+  memset(counts, 0, (ncode+1)*sizeof(long));
+  translate_count_bytes(s, len, NULL, counts, ncode+1);
+  return counts[ncode];
+}
+
+
+// Checks after trimming (hasq is 0 if there are no qualities)
+static int check_qualityFilter(qualityFilter *qf, long len, long sum, int min, long nn, int hasq) {
+  int qz=qf->qzero;
+
+  if ( len<qf->min_len ) return 0;
+  if ( qf->max_n>=0 && nn>qf->max_n ) return 0;
+  if (hasq && len>0) {
+    if ( min<qf->min_q+qz ) return 0;
+    if ( qf->min_mean>0. && (double)sum/len-qz < qf->min_mean ) return 0;
+  }
+
+  qf->npassed += 1;
+  return 1;
+}
+
+
+/*
+  Trim the sequence and return 1 if it passes the filter and 0 if not.
+*/
+int filter_Sequence(Sequence *seq, qualityFilter *qf) {
+  long len=seq->len, sum=0, nn=0;
+  int min=127, qz=qf->qzero;
+  char *q=seq->q, *s=(qf->ncode>=0 ? seq->s : NULL);
+
+  qf->nseen += 1;
+
+  if (q && len>0) {
+    if (qf->trail_q>0) while ( len>0 && q[len-1]<qf->trail_q+qz ) --len;
+    quality_stats(q, s, len, qf->ncode, &sum, &min, &nn);
+    // No window can have a low mean if no quality is low
+    if ( qf->window>0 && len>0 && min<qf->window_q+qz ) {
+      len = window_cut(q, len, qf->window, qf->window_q+qz);
+      quality_stats(q, s, len, qf->ncode, &sum, &min, &nn);
+    }
+    if (len<seq->len) {
+      seq->len = len;
+      qf->ntrimmed += 1;
+    }
+  }
+  // Without qualities only the N's are counted
+  else if (len>0 && s && qf->max_n>=0) nn = count_ncode(s, len, qf->ncode);
+
+  return check_qualityFilter(qf, len, sum, min, nn, (q!=NULL));
+}
+
+
+/*
+  Filter all sequences in the batch. The passing sequences are moved to
+  the start of b->seq (the list of next pointers is updated).
+  Returns the new number of sequences.
+*/
+int filter_seqBatch(seqBatch *b, qualityFilter *qf) {
+  int i, n=0;
+
+  for (i=0; i<b->n; ++i) {
+    if ( filter_Sequence(b->seq+i, qf) ) {
+      if (n<i) {
+	b->seq[n] = b->seq[i];
+	// Offsets are needed for lazy ids
+	memcpy(b->offsets+4*n, b->offsets+4*i, 4*sizeof(long));
+      }
+      b->seq[n].next = NULL;
+      if (n>0) b->seq[n-1].next = b->seq+n;
+      ++n;
+    }
+  }
+  b->n = n;
+
+  return n;
+}
+
+
+/*
+  As readFastq_fileBuffer, but returns the next sequence that passes the
+  filter (trimmed). The qualities of a read are still in cache from the
+  translation when the filter runs. Returns NULL on EOF.
+*/
+Sequence *readFastq_filter(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr,
+			   qualityFilter *qf) {
+  Sequence *seq;
+
+  while ( (seq=readFastq_fileBuffer(fb, seq_alph, qual_alph, save_descr)) ) {
+    if ( filter_Sequence(seq, qf) ) break;
+    free_Sequence(seq);
+  }
+
+  return seq;
+}
+
+
+
+/*************************************************
+
+Quality binning and run-length encoded qualities
+
+Example storing binned qualities of reads in little memory:
+
+  qb = illumina8_qualityBins(qual, 33);
+  pq = alloc_packedQual(qb);
+  while ( (seq=readFastq_fileBuffer(fb,dna,qual,1)) ) {
+    pack_qualities(seq->q, seq->len, pq);
+    if ( filter_packedQual(pq, seq->s, qf) ) {
+      ... (copy pq->run)
+    }
+    free_Sequence(seq);
+  }
+  free_packedQual(pq);
+  free(qb);
+
+*************************************************/
+
+
+/*
+  Set table and bin from the bin of each quality number. Numbers that are
+  not qualities (e.g. the terminator) are not changed.
+*/
+static qualityBins *alloc_qualityBins(AlphabetStruct *qual_alph) {
+  qualityBins *qb = (qualityBins *)calloc(1,sizeof(qualityBins));
+  int i;
+
+  if (qual_alph->len>128) ERROR("alloc_qualityBins: quality alphabet too long",1);
+  qb->ntable = qual_alph->len;
+  for (i=0; i<128; ++i) qb->table[i] = i;
+  return qb;
+}
+
+
+// Add the bin with value v (a quality number) if it is not there, and return it
+static int add_qualityBins(qualityBins *qb, int v) {
+  int b;
+  for (b=0; b<qb->nbins; ++b) if (qb->value[b]==v) return b;
+  if (qb->nbins==QBINS_MAX) ERROR("add_qualityBins: too many quality bins",1);
+  qb->value[qb->nbins] = v;
+  return qb->nbins++;
+}
+
+
+// First letter of the alphabet that is a quality (i.e. not the terminator)
+static int first_quality(AlphabetStruct *alph) {
+  return ( checkBit(alph->flag,AS_term) ? 1 : 0 );
+}
+
+
+/*
+  The 8 levels used by Illumina: phred 0-2 to 2, 3-9 to 6, 10-19 to 15,
+  20-24 to 22, 25-29 to 27, 30-34 to 33, 35-39 to 37 and 40- to 40.
+  All the levels must be in the alphabet.
+*/
+qualityBins *illumina8_qualityBins(AlphabetStruct *qual_alph, int phred_offset) {
+  static const int upper[8] = { 2, 9, 19, 24, 29, 34, 39, 1000 };
+  static const int level[8] = { 2, 6, 15, 22, 27, 33, 37, 40 };
+  qualityBins *qb = alloc_qualityBins(qual_alph);
+  int i, k, p, v=0;
+
+  for (i=first_quality(qual_alph); i<qual_alph->len; ++i) {
+    p = (uchar)qual_alph->a[i]-phred_offset;
+    if (p<0) p=0;
+    for (k=0; p>upper[k]; ++k);
+    if ( level[k]+phred_offset>=128 || (v=qual_alph->trans[level[k]+phred_offset])<=0 || qual_alph->a[v]!=level[k]+phred_offset )
+      ERROR("illumina8_qualityBins: quality alphabet does not contain all the levels",1);
+    qb->bin[i] = add_qualityBins(qb,v);
+    qb->table[i] = v;
+  }
+  return qb;
+}
+
+
+/*
+  Each quality goes to the highest letter of bin_alph that is not above it
+  (or the lowest letter if all are above). All letters of bin_alph must be
+  in the quality alphabet.
+*/
+qualityBins *alphabet_qualityBins(AlphabetStruct *qual_alph, AlphabetStruct *bin_alph) {
+  qualityBins *qb = alloc_qualityBins(qual_alph);
+  int i, j, c, best, lowest;
+  char letter[2];
+
+  for (i=first_quality(qual_alph); i<qual_alph->len; ++i) {
+    c = (uchar)qual_alph->a[i];
+    best = lowest = -1;
+    for (j=first_quality(bin_alph); j<bin_alph->len; ++j) {
+      if ( lowest<0 || bin_alph->a[j]<lowest ) lowest = (uchar)bin_alph->a[j];
+      if ( bin_alph->a[j]<=c && bin_alph->a[j]>best ) best = (uchar)bin_alph->a[j];
+    }
+    if (best<0) best = lowest;
+    if ( best<0 || qual_alph->a[(int)qual_alph->trans[best]]!=best ) {
+      letter[0] = best; letter[1] = 0;
+      ERRORs("alphabet_qualityBins: bin %s is not in the quality alphabet\n", letter, 1);
+    }
+    qb->bin[i] = add_qualityBins(qb, qual_alph->trans[best]);
+    qb->table[i] = qual_alph->trans[best];
+  }
+  return qb;
+}
+
+
+// Replace n qualities (numbers) by their binned values
+void bin_qualities(char *q, long n, qualityBins *qb) {
+  translate_copy_bytes(q, q, n, qb->table, qb->ntable);
+}
+
+
+packedQual *alloc_packedQual(qualityBins *qb) {
+  packedQual *pq = (packedQual *)malloc(sizeof(packedQual));
+  pq->len = pq->nruns = 0;
+  pq->nalloc = 256;
+  pq->run = (uchar *)malloc(pq->nalloc*sizeof(uchar));
+  pq->qb = qb;
+  return pq;
+}
+
+
+void free_packedQual(packedQual *pq) {
+  if (pq) {
+    free(pq->run);
+    free(pq);
+  }
+}
+
+
+/*
+  Bin and run-length encode n qualities into pq (which is reused).
+  Returns pq.
+*/
+packedQual *pack_qualities(char *q, long n, packedQual *pq) {
+  char *bin = pq->qb->bin;
+  long i, r=0;
+  int b, l;
+
+  // At most one run per quality
+  if (n>pq->nalloc) {
+    pq->nalloc = n;
+    pq->run = (uchar *)realloc(pq->run, pq->nalloc*sizeof(uchar));
+  }
+
+  for (i=0; i<n; i+=l) {
+    b = bin[(int)q[i]];
+    for (l=1; l<32 && i+l<n && bin[(int)q[i+l]]==b; ++l);
+    pq->run[r++] = (b<<5) | (l-1);
+  }
+  pq->nruns = r;
+  pq->len = n;
+
+  return pq;
+}
+
+
+// Binned qualities (pq->len numbers) are written to q
+void unpack_qualities(packedQual *pq, char *q) {
+  long r;
+  int l;
+
+  for (r=0; r<pq->nruns; ++r) {
+    l = runlen_packedQual(pq,r);
+    memset(q, qual_packedQual(pq,r), l);
+    q += l;
+  }
+}
+
+
+// Cut pq to length len
+static void truncate_packedQual(packedQual *pq, long len) {
+  long r, n=0;
+  int l;
+
+  for (r=0; r<pq->nruns && n<len; ++r) {
+    l = runlen_packedQual(pq,r);
+    if (n+l>len) {
+      l = len-n;
+      pq->run[r] = (pq->run[r]&0xE0) | (l-1);
+    }
+    n += l;
+  }
+  pq->nruns = r;
+  pq->len = len;
+}
+
+
+/*
+  As window_cut, but on the runs. Both ends of the window move a run at a
+  time, and the window sum only needs checking at the end of each step
+  (the first position below minq is then found by division).
+*/
+static long window_cut_packedQual(packedQual *pq, int w, int minq) {
+  long n=pq->len, p=0, sum=0, minsum, hr, tr, k, j;
+  int hl, tl, d;
+  char value[QBINS_MAX];
+  uchar *run;
+
+  if (n<w) w=n;
+  if (w<=0) return n;
+  minsum = (long)w*minq;
+
+  // First window. hr, hl is the run and bases left of the next base in
+  for (hr=0, k=0; hr<pq->nruns && k+runlen_packedQual(pq,hr)<=w; k+=runlen_packedQual(pq,hr), ++hr)
+    sum += (long)runlen_packedQual(pq,hr)*qual_packedQual(pq,hr);
+  hl = 0;
+  if (k<w) {
+    sum += (long)(w-k)*qual_packedQual(pq,hr);
+    hl = runlen_packedQual(pq,hr)-(w-k);
+  }
+  else if (hr<pq->nruns) hl = runlen_packedQual(pq,hr);
+  if (sum<minsum) return 0;
+  tr = 0;
+  tl = runlen_packedQual(pq,0);
+
+  // Local copies, as the compiler cannot keep them in registers otherwise
+  memcpy(value, pq->qb->value, QBINS_MAX);
+  run = pq->run;
+  while (p+w<n) {
+    k = MINIMUM(hl,tl);
+    k = MINIMUM(k,n-p-w);
+    d = value[run[hr]>>5]-value[run[tr]>>5];
+    if ( d<0 && sum+k*d<minsum ) {
+      j = (sum-minsum)/(-d)+1;
+      return p+j;
+    }
+    sum += k*d;
+    p += k;
+    hl -= k;
+    tl -= k;
+    if (hl==0 && ++hr<pq->nruns) hl = 1+(run[hr]&31);
+    if (tl==0) tl = 1+(run[++tr]&31);
+  }
+  return n;
+}
+
+
+/*
+  As filter_Sequence on the qualities in pq, which are trimmed (pq->len
+  is the new length). s is the sequence (for counting N's, can be NULL).
+*/
+int filter_packedQual(packedQual *pq, char *s, qualityFilter *qf) {
+  long r, len=pq->len, orig=pq->len, sum=0, nn=0;
+  int l, v, min=127, qz=qf->qzero;
+
+  qf->nseen += 1;
+
+  if (qf->trail_q>0) {
+    for (r=pq->nruns-1; r>=0 && qual_packedQual(pq,r)<qf->trail_q+qz; --r) len -= runlen_packedQual(pq,r);
+    truncate_packedQual(pq,len);
+  }
+  if ( qf->window>0 ) {
+    for (r=0; r<pq->nruns; ++r) if ( qual_packedQual(pq,r)<qf->window_q+qz ) break;
+    if ( r<pq->nruns ) truncate_packedQual(pq, window_cut_packedQual(pq, qf->window, qf->window_q+qz));
+  }
+  if (pq->len<orig) qf->ntrimmed += 1;
+  len = pq->len;
+
+  for (r=0; r<pq->nruns; ++r) {
+    l = runlen_packedQual(pq,r);
+    v = qual_packedQual(pq,r);
+    sum += (long)l*v;
+    if (v<min) min=v;
+  }
+  if (s && qf->ncode>=0 && qf->max_n>=0 && len>0) nn = count_ncode(s, len, qf->ncode);
+
+  return check_qualityFilter(qf, len, sum, min, nn, 1);
+}
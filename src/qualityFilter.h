@@ -0,0 +1,93 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef QUALITYFILTER_H
+#define QUALITYFILTER_H
+
+/*
+  Quality trimming and filtering of reads
+
+  A qualityFilter is applied to a Sequence right after it has been read
+  (with qualities translated by the quality alphabet). In order:
+    trail_q    bases at the 3' end with quality below trail_q are removed
+    window     the read is cut at the start of the first window of this
+               length with mean quality below window_q
+    min_len    reads shorter than this after trimming are rejected
+    min_mean   reads with mean quality below this are rejected
+    min_q      reads with a quality below this are rejected
+    max_n      reads with more than max_n N's are rejected
+  Trimming only changes seq->len. Qualities are given as phred scores and
+  a check is turned off with 0 (-1 for max_n), which is the default from
+  alloc_qualityFilter.
+
+  Mean, minimum and N count are found in one vectorized pass
+  (quality_stats in simdKernels).
+
+  Quality binning maps the qualities to a few values, either the 8 levels
+  of Illumina (2, 6, 15, 22, 27, 33, 37 and 40) or the letters of an
+  alphabet (each quality goes to the highest letter not above it).
+  Binned qualities can be stored in a packedQual, which is run-length
+  encoded with one byte per run (bin in the top 3 bits, run length 1-32
+  in the lower 5). filter_packedQual trims and filters on the runs.
+
+  Include akstandard.h, simpleHash.h, fileBuffer.h and sequence.h before
+  this file.
+*/
+
+typedef struct {
+  int qzero;         // Number of phred score 0 in the quality alphabet
+  int ncode;         // Number of N in the sequence alphabet (-1 if none)
+  int trail_q;
+  int window;
+  int window_q;
+  int min_len;
+  double min_mean;
+  int min_q;
+  int max_n;
+  long nseen;        // Counts of reads filtered, trimmed and passed
+  long ntrimmed;
+  long npassed;
+} qualityFilter;
+
+
+#define QBINS_MAX 8
+
+typedef struct {
+  int nbins;
+  int ntable;               // Length of the quality alphabet
+  char value[QBINS_MAX];    // Quality number of each bin
+  char bin[128];            // Bin of each quality number
+  char table[128];          // Binned quality number of each quality number
+} qualityBins;
+
+
+typedef struct {
+  long len;          // Number of qualities
+  long nruns;
+  long nalloc;
+  uchar *run;        // bin<<5 | (length-1)
+  qualityBins *qb;
+} packedQual;
+
+static inline int qual_packedQual(packedQual *pq, long r) { return pq->qb->value[pq->run[r]>>5]; }
+static inline int runlen_packedQual(packedQual *pq, long r) { return 1+(pq->run[r]&31); }
+
+
+qualityFilter *alloc_qualityFilter(AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int phred_offset);
+int filter_Sequence(Sequence *seq, qualityFilter *qf);
+int filter_seqBatch(seqBatch *b, qualityFilter *qf);
+Sequence *readFastq_filter(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr,
+			   qualityFilter *qf);
+qualityBins *illumina8_qualityBins(AlphabetStruct *qual_alph, int phred_offset);
+qualityBins *alphabet_qualityBins(AlphabetStruct *qual_alph, AlphabetStruct *bin_alph);
+void bin_qualities(char *q, long n, qualityBins *qb);
+packedQual *alloc_packedQual(qualityBins *qb);
+void free_packedQual(packedQual *pq);
+packedQual *pack_qualities(char *q, long n, packedQual *pq);
+void unpack_qualities(packedQual *pq, char *q);
+int filter_packedQual(packedQual *pq, char *s, qualityFilter *qf);
+
+#endif
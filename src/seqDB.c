@@ -0,0 +1,193 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  Binary sequence database (see seqDB.h for the file format)
+
+  Writing:
+    seqDBwriter *w = open_seqDBwriter("db.sdb",alph);
+    while ( (seq=readFasta_fileBuffer(fb,alph,1)) ) {
+      add_seqDBwriter(w,seq);
+      free_Sequence(seq);
+    }
+    close_seqDBwriter(w);
+
+  Reading:
+    seqDB *db = open_seqDB("db.sdb",0);
+    for (i=0; i<db->nseq; ++i) {
+      seq = get_seqDB(db,i);
+      ...
+      free_Sequence(seq);
+    }
+    close_seqDB(db);
+
+  A Sequence from get_seqDB points into the mapped file. If the database
+  is opened with writable=0 the sequence must not be changed (e.g. by
+  revcompSequence); with writable=1 changes are private to the process.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "akstandard.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "sequence.h"
+#include "seqDB.h"
+
+
+// The residues are written as they are added, and their length is filled in at the end
+seqDBwriter *open_seqDBwriter(char *filename, AlphabetStruct *alph) {
+  seqDBwriter *w = (seqDBwriter *)malloc(sizeof(seqDBwriter));
+  long zero=0;
+
+  w->fp = open_file_write(filename, NULL, "sequence database");
+  w->alph = alph;
+  w->nseq = w->nres = 0;
+  w->nalloc = 1024;
+  w->offsets = (long *)malloc(w->nalloc*sizeof(long));
+  w->id_offsets = (long *)malloc(w->nalloc*sizeof(long));
+  w->ids_len = 0;
+  w->ids_alloc = (1<<16);
+  w->ids = (char *)malloc(w->ids_alloc*sizeof(char));
+
+  fwrite(SEQDB_MAGIC, 1, 8, w->fp);
+  write_AlphabetStruct(alph, w->fp);
+  falignArrayLong(w->fp);
+  fwrite(&zero, sizeof(long), 1, w->fp);
+
+  return w;
+}
+
+
+static void add_id_seqDBwriter(seqDBwriter *w, char *s) {
+  long n = (s ? strlen(s) : 0);
+  if (w->ids_len+n+1 > w->ids_alloc) {
+    while (w->ids_len+n+1 > w->ids_alloc) w->ids_alloc *= 2;
+    w->ids = (char *)realloc(w->ids, w->ids_alloc*sizeof(char));
+  }
+  if (n) memcpy(w->ids+w->ids_len, s, n);
+  w->ids[w->ids_len+n] = '\0';
+  w->ids_len += n+1;
+}
+
+
+// The sequence must be translated with the alphabet of the database
+void add_seqDBwriter(seqDBwriter *w, Sequence *seq) {
+  if (w->nseq+1 >= w->nalloc) {
+    w->nalloc *= 2;
+    w->offsets = (long *)realloc(w->offsets, w->nalloc*sizeof(long));
+    w->id_offsets = (long *)realloc(w->id_offsets, w->nalloc*sizeof(long));
+  }
+  w->offsets[w->nseq] = w->nres;
+  w->id_offsets[w->nseq] = w->ids_len;
+  add_id_seqDBwriter(w, seq->id);
+  add_id_seqDBwriter(w, seq->descr);
+  if (seq->len>0 && (long)fwrite(seq->s, 1, seq->len, w->fp)!=seq->len) ERROR("add_seqDBwriter: write failed",1);
+  w->nres += seq->len;
+  w->nseq += 1;
+}
+
+
+// Writes the tables and closes the file
+void close_seqDBwriter(seqDBwriter *w) {
+  long pos;
+
+  // Length of residue array is written before the residues
+  pos = ftell(w->fp) - w->nres - sizeof(long);
+  fseek(w->fp, pos, SEEK_SET);
+  fwrite(&(w->nres), sizeof(long), 1, w->fp);
+  fseek(w->fp, 0, SEEK_END);
+
+  w->offsets[w->nseq] = w->nres;
+  w->id_offsets[w->nseq] = w->ids_len;
+
+  falignArrayLong(w->fp);
+  fwriteArrayLong(w->offsets, sizeof(long), w->nseq+1, w->fp);
+  falignArrayLong(w->fp);
+  fwriteArrayLong(w->id_offsets, sizeof(long), w->nseq+1, w->fp);
+  falignArrayLong(w->fp);
+  fwriteArrayLong(w->ids, 1, w->ids_len, w->fp);
+
+  if ( fclose(w->fp)!=0 ) ERROR("close_seqDBwriter: write failed",1);
+  free(w->offsets);
+  free(w->id_offsets);
+  free(w->ids);
+  free(w);
+}
+
+
+// Point to the next array in the map and return its length in bytes
+static long array_seqDB(fileBuffer *map, long *pos, char **a) {
+  long n = mapArrayLong(map->buf, map->len, pos, a);
+  if (n<0) ERROR("open_seqDB: file is truncated",1);
+  return n;
+}
+
+
+/*
+  Open a database. Only the alphabet is read; the rest is memory mapped.
+  If writable!=0 the sequences can be changed in memory (not in the file).
+*/
+seqDB *open_seqDB(char *filename, int writable) {
+  seqDB *db;
+  FILE *fp;
+  char magic[8], *a;
+  long pos;
+
+  fp = open_file_read(filename, NULL, "sequence database");
+  if ( fread(magic, 1, 8, fp)!=8 || memcmp(magic, SEQDB_MAGIC, 8)!=0 )
+    ERRORs("open_seqDB: %s is not a sequence database\n", filename, 1);
+
+  db = (seqDB *)malloc(sizeof(seqDB));
+  db->alph = read_AlphabetStruct(fp);
+  pos = ftell(fp);
+  fclose(fp);
+
+  db->map = mmap_fileBuffer(filename, writable);
+  if (!db->map) ERRORs("open_seqDB: Could not map file %s\n", filename, 1);
+
+  array_seqDB(db->map, &pos, &(db->residues));
+  db->nseq = array_seqDB(db->map, &pos, &a)/sizeof(long) - 1;
+  db->offsets = (long *)a;
+  array_seqDB(db->map, &pos, &a);
+  db->id_offsets = (long *)a;
+  array_seqDB(db->map, &pos, &(db->ids));
+
+  return db;
+}
+
+
+void close_seqDB(seqDB *db) {
+  if (db) {
+    free_fileBuffer(db->map);
+    free_AlphabetStruct(db->alph);
+    free(db);
+  }
+}
+
+
+/*
+  Returns sequence i as a Sequence pointing into the database
+  (free_Sequence only frees the Sequence itself)
+*/
+Sequence *get_seqDB(seqDB *db, long i) {
+  Sequence *seq;
+  char *id;
+
+  if (i<0 || i>=db->nseq) return NULL;
+
+  seq = alloc_Sequence();
+  id = id_seqDB(db,i);
+  if (*id) seq->id = id;
+  id += strlen(id)+1;
+  if (*id) seq->descr = id;
+  seq->len = len_seqDB(db,i);
+  seq->s = residues_seqDB(db,i);
+
+  return seq;
+}
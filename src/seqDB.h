@@ -0,0 +1,70 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef SEQDB_H
+#define SEQDB_H
+
+/*
+  Binary sequence database
+
+  Sequences are written once (already translated) to a binary file, which
+  is memory mapped when opened, so opening takes the same time for any
+  size of database and sequence i is found directly.
+
+  The file contains (all lengths and offsets are long):
+    magic string "akseqdb1"
+    the alphabet (as written by write_AlphabetStruct)
+    residues       array with all sequences after each other
+    offsets        array of nseq+1 offsets into residues
+    id_offsets     array of nseq+1 offsets into ids
+    ids            array with "id\0descr\0" for each sequence
+  Each array is written with fwriteArrayLong (length in bytes followed by
+  the data) starting at a position divisible by 8.
+
+  Include akstandard.h, simpleHash.h, fileBuffer.h and sequence.h before
+  this file.
+*/
+
+#define SEQDB_MAGIC "akseqdb1"
+
+typedef struct {
+  FILE *fp;
+  AlphabetStruct *alph;
+  long nseq;
+  long nres;              // Residues written
+  long nalloc;
+  long *offsets;
+  long *id_offsets;
+  long ids_len;
+  long ids_alloc;
+  char *ids;
+} seqDBwriter;
+
+
+typedef struct {
+  fileBuffer *map;        // The mapped file
+  AlphabetStruct *alph;
+  long nseq;
+  long *offsets;          // Points into the map
+  long *id_offsets;
+  char *ids;
+  char *residues;
+} seqDB;
+
+
+static inline long len_seqDB(seqDB *db, long i) { return db->offsets[i+1]-db->offsets[i]; }
+static inline char *residues_seqDB(seqDB *db, long i) { return db->residues+db->offsets[i]; }
+static inline char *id_seqDB(seqDB *db, long i) { return db->ids+db->id_offsets[i]; }
+
+
+seqDBwriter *open_seqDBwriter(char *filename, AlphabetStruct *alph);
+void add_seqDBwriter(seqDBwriter *w, Sequence *seq);
+void close_seqDBwriter(seqDBwriter *w);
+seqDB *open_seqDB(char *filename, int writable);
+void close_seqDB(seqDB *db);
+Sequence *get_seqDB(seqDB *db, long i);
+
+#endif
@@ -0,0 +1,585 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  Name index of fasta/fastq records (see seqIndex.h for the file format)
+
+  Usage:
+    seqIndex *ix = load_seqIndex("reads.fq",'@',dna,8,1);
+    FILE *fp = fopen("reads.fq","r");
+    i = lookup_seqIndex(ix,"read123");
+    seq = fetch_seqIndex(ix,fp,i,dna,qual,1);
+    ...
+    free_Sequence(seq);
+    free_seqIndex(ix);
+
+  load_seqIndex opens reads.fq.aix, or builds the index (and writes it if
+  write!=0). The file is read in chunks cut at record starts (as in
+  parallelReader), and each chunk is parsed by a worker, which gives the
+  ids and file positions of its records. The names are added to the
+  dictionary by the master in file order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inThreads.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "sequence.h"
+#include "parallelReader.h"
+#include "idDict.h"
+#include "seqIndex.h"
+
+// Bytes read for each chunk
+#define SEQINDEX_CHUNK (1<<24)
+
+
+typedef struct {
+  char *data;
+  long len;
+  long offset;            // File position of data
+  int type;
+  AlphabetStruct *alph;
+  long n;                 // Records found
+  long nalloc;
+  long *pos;              // Their file positions
+  long nlen;
+  long nsize;
+  char *names;            // Their ids (each followed by '\0')
+} indexJob;
+
+
+// Worker function finding the records of a chunk
+static int index_chunk(int thread, void *x) {
+  indexJob *job = (indexJob *)x;
+  fileBuffer *fb = memory_fileBuffer(job->data, job->len, 0);
+  Sequence *seq;
+  long pos, l;
+
+  fb->offset = job->offset;
+  job->n = job->nlen = 0;
+  job->nalloc = 1024;
+  job->pos = (long *)malloc(job->nalloc*sizeof(long));
+  job->nsize = (1<<16);
+  job->names = (char *)malloc(job->nsize*sizeof(char));
+
+  if ( ReadSequenceFileHeader_fileBuffer(fb, job->type) ) {
+    while ( 1 ) {
+      // fb is just after the '>' or '@'
+      pos = tell_fileBuffer(fb)-1;
+      if (job->type=='@') seq = readFastq_fileBuffer(fb, job->alph, NULL, 0);
+      else seq = readFasta_fileBuffer(fb, job->alph, 0);
+      if (!seq) break;
+      if (job->n==job->nalloc) {
+	job->nalloc *= 2;
+	job->pos = (long *)realloc(job->pos, job->nalloc*sizeof(long));
+      }
+      job->pos[job->n++] = pos;
+      l = (seq->id ? strlen(seq->id) : 0);
+      if (job->nlen+l+1 > job->nsize) {
+	while (job->nlen+l+1 > job->nsize) job->nsize *= 2;
+	job->names = (char *)realloc(job->names, job->nsize*sizeof(char));
+      }
+      if (l) memcpy(job->names+job->nlen, seq->id, l);
+      job->names[job->nlen+l] = '\0';
+      job->nlen += l+1;
+      free_Sequence(seq);
+    }
+  }
+
+  free_fileBuffer(fb);
+  free(job->data);
+  job->data = NULL;
+
+  return 0;
+}
+
+
+// Read a chunk and cut it after the last record start (see read_chunk in parallelReader.c)
+static indexJob *read_index_chunk(FILE *fp, long *offset, char **rest, long *nrest, int *eof, int type) {
+  long n, r, split, alloc;
+  char *buf;
+  indexJob *job;
+
+  if (*eof && *nrest==0) return NULL;
+
+  alloc = *nrest+SEQINDEX_CHUNK;
+  buf = (char *)malloc(alloc*sizeof(char));
+  n = *nrest;
+  if (*rest) { memcpy(buf, *rest, n); free(*rest); *rest=NULL; }
+  *nrest = 0;
+
+  while ( 1 ) {
+    if (!*eof) {
+      if (alloc-n < SEQINDEX_CHUNK) {
+	alloc = n+SEQINDEX_CHUNK;
+	buf = (char *)realloc(buf, alloc*sizeof(char));
+      }
+      r = fread(buf+n, 1, SEQINDEX_CHUNK, fp);
+      n += r;
+      if (r<SEQINDEX_CHUNK) *eof=1;
+    }
+    if (*eof) { split = n; break; }
+    if ( (split = last_record_start(buf, n, type)) > 0 ) break;
+  }
+
+  if (split<n) {
+    *nrest = n-split;
+    *rest = (char *)malloc(*nrest*sizeof(char));
+    memcpy(*rest, buf+split, *nrest);
+  }
+
+  job = (indexJob *)malloc(sizeof(indexJob));
+  job->data = buf;
+  job->len = split;
+  job->offset = *offset;
+  *offset += split;
+
+  return job;
+}
+
+
+static seqIndex *alloc_seqIndex(int type) {
+  seqIndex *ix = (seqIndex *)malloc(sizeof(seqIndex));
+  ix->type = type;
+  ix->n = 0;
+  ix->offset = NULL;
+  ix->names = NULL;
+  ix->map = NULL;
+  return ix;
+}
+
+
+// Add the records of a finished chunk to the index
+static void add_chunk_seqIndex(seqIndex *ix, indexJob *job, long *nalloc) {
+  long i;
+  char *name = job->names;
+
+  if (ix->n+job->n+1 > *nalloc) {
+    while (ix->n+job->n+1 > *nalloc) *nalloc *= 2;
+    ix->offset = (long *)realloc(ix->offset, *nalloc*sizeof(long));
+  }
+  for (i=0; i<job->n; ++i) {
+    ix->offset[ix->n++] = job->pos[i];
+    add_idDict(ix->names, name, 0);
+    name += strlen(name)+1;
+  }
+  free(job->pos);
+  free(job->names);
+  free(job);
+}
+
+
+/*
+  Build the index of a fasta (type='>') or fastq (type='@') file from the
+  current position of fp to the end. alph is used for reading the
+  sequences (any alphabet will do).
+*/
+seqIndex *build_seqIndex(FILE *fp, int type, AlphabetStruct *alph, int nthreads) {
+  seqIndex *ix;
+  inThreads *threads;
+  indexJob *job;
+  long offset, nrest=0, nalloc=1024;
+  char *rest=NULL;
+  int eof=0, jobs=0;
+
+  if ( type!='>' && type!='@' ) ERROR("build_seqIndex: type must be '>' or '@'",1);
+  if (nthreads<1) nthreads=1;
+
+  ix = alloc_seqIndex(type);
+  ix->offset = (long *)malloc(nalloc*sizeof(long));
+  ix->names = alloc_idDict(1);
+
+  offset = ftell(fp);
+  if (offset<0) offset=0;
+
+  threads = init_inThreads(nthreads, index_chunk);
+  start_inThreads(threads);
+
+  while ( 1 ) {
+    // Keep 2*nthreads chunks in the queue
+    while ( jobs < 2*nthreads && (job=read_index_chunk(fp, &offset, &rest, &nrest, &eof, type)) ) {
+      job->type = type;
+      job->alph = alph;
+      new_job_inThreads(threads, (void *)job);
+      jobs += 1;
+    }
+    if ( eof && nrest==0 && !threads->no_more_jobs ) finished_jobqueue_inThreads(threads);
+    if (jobs==0) break;
+    while ( !(job=(indexJob *)next_output_inThreads(threads)) ) millisleep(threads->sleep);
+    jobs -= 1;
+    add_chunk_seqIndex(ix, job, &nalloc);
+  }
+  cleanup_inThreads(threads);
+
+  ix->offset[ix->n] = offset;
+
+  return ix;
+}
+
+
+void write_seqIndex(seqIndex *ix, char *filename) {
+  FILE *fp = open_file_write(filename, NULL, "sequence index");
+  long head[3];
+
+  head[0] = ix->type;
+  head[1] = ix->n;
+  head[2] = ix->offset[ix->n];
+  fwrite(SEQINDEX_MAGIC, 1, 8, fp);
+  fwriteArrayLong(head, sizeof(long), 3, fp);
+  falignArrayLong(fp);
+  fwriteArrayLong(ix->offset, sizeof(long), ix->n+1, fp);
+  write_idDict(ix->names, fp);
+
+  if ( fclose(fp)!=0 ) ERROR("write_seqIndex: write failed",1);
+}
+
+
+// Open an index file (it is memory mapped)
+seqIndex *open_seqIndex(char *filename) {
+  seqIndex *ix;
+  fileBuffer *map;
+  long pos=8, *head;
+  char *a;
+
+  map = mmap_fileBuffer(filename, 0);
+  if (!map) ERRORs("open_seqIndex: Could not map file %s\n", filename, 1);
+  if ( map->len<8 || memcmp(map->buf, SEQINDEX_MAGIC, 8)!=0
+       || mapArrayLong(map->buf, map->len, &pos, &a)!=3*sizeof(long) )
+    ERRORs("open_seqIndex: %s is not a sequence index\n", filename, 1);
+
+  head = (long *)a;
+  ix = alloc_seqIndex((int)head[0]);
+  ix->n = head[1];
+  ix->map = map;
+
+  if ( mapArrayLong(map->buf, map->len, &pos, &a) != (ix->n+1)*(long)sizeof(long) )
+    ERRORs("open_seqIndex: %s is truncated\n", filename, 1);
+  ix->offset = (long *)a;
+  if ( ix->offset[ix->n]!=head[2] ) ERRORs("open_seqIndex: %s is not a sequence index\n", filename, 1);
+  ix->names = map_idDict(map, &pos);
+
+  return ix;
+}
+
+
+/*
+  The size of the sequence file in the header of an index file, or -1 if
+  it is not an index (of this version) of the given type
+*/
+static long indexed_size_seqIndex(char *filename, int type) {
+  FILE *fp = fopen(filename,"r");
+  char magic[8];
+  long head[4], size=-1;
+
+  if (!fp) return -1;
+  if ( fread(magic, 1, 8, fp)==8 && memcmp(magic, SEQINDEX_MAGIC, 8)==0 && fread(head, sizeof(long), 4, fp)==4
+       && head[0]==3*sizeof(long) && head[1]==type ) size = head[3];
+  fclose(fp);
+
+  return size;
+}
+
+
+/*
+  Open the index seqfile.aix. If it does not exist, or was made for a
+  file of another size (so the sequence file has changed), it is built
+  from the sequence file and written if write!=0. Returns NULL if the
+  sequence file cannot be opened.
+*/
+seqIndex *load_seqIndex(char *seqfile, int type, AlphabetStruct *alph, int nthreads, int write) {
+  char *ifile = (char *)malloc((strlen(seqfile)+5)*sizeof(char));
+  seqIndex *ix=NULL;
+  FILE *fp;
+  long size;
+
+  sprintf(ifile,"%s.aix",seqfile);
+  if ( (fp=fopen(seqfile,"r")) ) {
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if ( indexed_size_seqIndex(ifile, type)==size ) ix = open_seqIndex(ifile);
+    else {
+      ix = build_seqIndex(fp, type, alph, nthreads);
+      if (write) write_seqIndex(ix, ifile);
+    }
+    fclose(fp);
+  }
+  free(ifile);
+
+  return ix;
+}
+
+
+void free_seqIndex(seqIndex *ix) {
+  if (ix) {
+    free_idDict(ix->names);
+    if (ix->map) free_fileBuffer(ix->map);
+    else free(ix->offset);
+    free(ix);
+  }
+}
+
+
+// Returns the number of the record with this id (-1 if not found)
+long lookup_seqIndex(seqIndex *ix, char *name) {
+  return lookup_idDict(ix->names, name, 0);
+}
+
+
+// Read record i from a buffer holding exactly that record
+static Sequence *read_record_seqIndex(seqIndex *ix, char *buf, long len, AlphabetStruct *seq_alph,
+				      AlphabetStruct *qual_alph, int save_descr) {
+  fileBuffer *fb = memory_fileBuffer(buf, len, 0);
+  Sequence *seq;
+
+  if ( len<1 || buf[0]!=ix->type ) ERROR("fetch_seqIndex: The index does not fit the file",1);
+  fb->pos = 1;
+  if (ix->type=='@') seq = readFastq_fileBuffer(fb, seq_alph, qual_alph, save_descr);
+  else seq = readFasta_fileBuffer(fb, seq_alph, save_descr);
+  free_fileBuffer(fb);
+
+  return seq;
+}
+
+
+/*
+  Read record i from fp (the file that was indexed) as readFastq or
+  readFasta would. Returns NULL if there is no record i.
+*/
+Sequence *fetch_seqIndex(seqIndex *ix, FILE *fp, long i, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+			 int save_descr) {
+  long len;
+  char *buf;
+  Sequence *seq;
+
+  if (i<0 || i>=ix->n) return NULL;
+  len = ix->offset[i+1]-ix->offset[i];
+  buf = (char *)malloc(len*sizeof(char));
+  if ( fseek(fp, ix->offset[i], SEEK_SET)!=0 || (long)fread(buf, 1, len, fp)!=len )
+    ERROR("fetch_seqIndex: Could not read the record",1);
+  seq = read_record_seqIndex(ix, buf, len, seq_alph, qual_alph, save_descr);
+  free(buf);
+
+  return seq;
+}
+
+
+// As fetch_seqIndex from a file memory mapped with mmap_fileBuffer
+Sequence *fetch_seqIndex_mmap(seqIndex *ix, fileBuffer *fb, long i, AlphabetStruct *seq_alph,
+			      AlphabetStruct *qual_alph, int save_descr) {
+  if (i<0 || i>=ix->n) return NULL;
+  if ( ix->offset[i+1] > fb->len ) ERROR("fetch_seqIndex_mmap: The index does not fit the file",1);
+  return read_record_seqIndex(ix, fb->buf+ix->offset[i], ix->offset[i+1]-ix->offset[i], seq_alph, qual_alph,
+			      save_descr);
+}
+
+
+
+/*************************************************
+
+Checkpoint index
+
+Made while reading the file:
+
+  checkpointIndex *ck = alloc_checkpointIndex('@',10000);
+  ReadSequenceFileHeader_fileBuffer(fb,'@');
+  while ( (seq=read_checkpointIndex(ck,fb,dna,qual,0)) ) {
+    ...
+  }
+  write_checkpointIndex(ck,"reads.fq.ack");
+
+Shard k of K in a worker:
+
+  n = shard_checkpointIndex(ck,k,K,&first);
+  fb = seek_checkpointIndex(ck,fp,first,dna);
+  for (i=0; i<n; ++i) {
+    seq = readFastq_fileBuffer(fb,dna,qual,0);
+    ...
+  }
+
+Shards start at checkpoints, so seeking to them does not read anything.
+
+*************************************************/
+
+#define CHECKPOINT_MAGIC "akckpt01"
+
+
+checkpointIndex *alloc_checkpointIndex(int type, long every) {
+  checkpointIndex *ck = (checkpointIndex *)malloc(sizeof(checkpointIndex));
+  if ( type!='>' && type!='@' ) ERROR("alloc_checkpointIndex: type must be '>' or '@'",1);
+  ck->type = type;
+  ck->every = (every<1 ? 1 : every);
+  ck->nrec = ck->n = 0;
+  ck->nalloc = 1024;
+  ck->offset = (long *)malloc(ck->nalloc*sizeof(long));
+  ck->offset[0] = 0;
+  return ck;
+}
+
+
+void free_checkpointIndex(checkpointIndex *ck) {
+  if (ck) {
+    free(ck->offset);
+    free(ck);
+  }
+}
+
+
+static void add_checkpointIndex(checkpointIndex *ck, long pos) {
+  if (ck->n+1 >= ck->nalloc) {
+    ck->nalloc *= 2;
+    ck->offset = (long *)realloc(ck->offset, ck->nalloc*sizeof(long));
+  }
+  ck->offset[ck->n++] = pos;
+}
+
+
+/*
+  Read the next record as readFastq_fileBuffer or readFasta_fileBuffer
+  (fb must be just after the '@' or '>') and note its position if it is
+  a checkpoint. The end of the records read so far is kept in
+  ck->offset[ck->n], so the index can be written or sharded even if the
+  reading stops before EOF. At EOF NULL is returned. fb must know its
+  file position (fb->offset), which it does if the file was read from
+  the beginning.
+*/
+Sequence *read_checkpointIndex(checkpointIndex *ck, fileBuffer *fb, AlphabetStruct *seq_alph,
+			       AlphabetStruct *qual_alph, int save_descr) {
+  long pos = tell_fileBuffer(fb)-1;
+  Sequence *seq;
+
+  if (ck->type=='@') seq = readFastq_fileBuffer(fb, seq_alph, qual_alph, save_descr);
+  else seq = readFasta_fileBuffer(fb, seq_alph, save_descr);
+
+  if (seq) {
+    if (ck->nrec%ck->every==0) add_checkpointIndex(ck, pos);
+    ck->nrec += 1;
+    // Unless at EOF, the reader has passed the '@' or '>' of the next record
+    ck->offset[ck->n] = tell_fileBuffer(fb) - (peek_fileBuffer(fb)==EOF ? 0 : 1);
+  }
+  else ck->offset[ck->n] = tell_fileBuffer(fb);
+
+  return seq;
+}
+
+
+// Make a checkpoint index from a full index
+checkpointIndex *checkpoints_seqIndex(seqIndex *ix, long every) {
+  checkpointIndex *ck = alloc_checkpointIndex(ix->type, every);
+  long i;
+
+  for (i=0; i<ix->n; i+=ck->every) add_checkpointIndex(ck, ix->offset[i]);
+  ck->nrec = ix->n;
+  ck->offset[ck->n] = ix->offset[ix->n];
+
+  return ck;
+}
+
+
+void write_checkpointIndex(checkpointIndex *ck, char *filename) {
+  FILE *fp = open_file_write(filename, NULL, "checkpoint index");
+  long head[4];
+
+  head[0] = ck->type;
+  head[1] = ck->every;
+  head[2] = ck->nrec;
+  head[3] = ck->n;
+  fwrite(CHECKPOINT_MAGIC, 1, 8, fp);
+  fwriteArrayLong(head, sizeof(long), 4, fp);
+  fwriteArrayLong(ck->offset, sizeof(long), ck->n+1, fp);
+
+  if ( fclose(fp)!=0 ) ERROR("write_checkpointIndex: write failed",1);
+}
+
+
+checkpointIndex *read_checkpointIndex_file(char *filename) {
+  FILE *fp = open_file_read(filename, NULL, "checkpoint index");
+  checkpointIndex *ck;
+  char magic[8];
+  long *head, n;
+
+  if ( fread(magic, 1, 8, fp)!=8 || memcmp(magic, CHECKPOINT_MAGIC, 8)!=0 )
+    ERRORs("read_checkpointIndex_file: %s is not a checkpoint index\n", filename, 1);
+  head = (long *)freadArrayLong(sizeof(long), &n, 0, fp);
+  if (n!=4) ERRORs("read_checkpointIndex_file: %s has wrong format\n", filename, 1);
+
+  ck = (checkpointIndex *)malloc(sizeof(checkpointIndex));
+  ck->type = (int)head[0];
+  ck->every = head[1];
+  ck->nrec = head[2];
+  ck->n = head[3];
+  ck->offset = (long *)freadArrayLong(sizeof(long), &n, 0, fp);
+  if (n!=ck->n+1) ERRORs("read_checkpointIndex_file: %s has wrong format\n", filename, 1);
+  ck->nalloc = n;
+  free(head);
+  fclose(fp);
+
+  return ck;
+}
+
+
+/*
+  Returns a fileBuffer reading fp from the start of the given record
+  (just after its '@' or '>', as after ReadSequenceFileHeader_fileBuffer).
+  It starts at the checkpoint before the record, and the records up to
+  it are read (with alph) and thrown away. Returns NULL if there is no
+  such record.
+*/
+fileBuffer *seek_checkpointIndex(checkpointIndex *ck, FILE *fp, long record, AlphabetStruct *alph) {
+  fileBuffer *fb;
+  Sequence *seq;
+  long c, i;
+
+  if (record<0 || record>=ck->nrec) return NULL;
+  c = record/ck->every;
+  if ( fseek(fp, ck->offset[c], SEEK_SET)!=0 ) ERROR("seek_checkpointIndex: Could not seek in file",1);
+  fb = alloc_fileBuffer(fp, 0);
+  fb->offset = ck->offset[c];
+  if ( getc_fileBuffer(fb)!=ck->type ) ERROR("seek_checkpointIndex: The index does not fit the file",1);
+
+  for (i=c*ck->every; i<record; ++i) {
+    if (ck->type=='@') seq = readFastq_fileBuffer(fb, alph, NULL, 0);
+    else seq = readFasta_fileBuffer(fb, alph, 0);
+    if (!seq) ERROR("seek_checkpointIndex: The index does not fit the file",1);
+    free_Sequence(seq);
+  }
+
+  return fb;
+}
+
+
+/*
+  Split the records in nshards parts of about the same number of bytes
+  (each starting at a checkpoint). Sets *first to the first record of
+  shard k (0<=k<nshards) and returns its number of records (which can be
+  0 if there are few checkpoints).
+*/
+long shard_checkpointIndex(checkpointIndex *ck, int k, int nshards, long *first) {
+  long c[2], target, lo, hi, mid;
+  long start = ck->offset[0], total = ck->offset[ck->n]-ck->offset[0];
+  int j;
+
+  // c[0] and c[1] are the first checkpoints of shard k and k+1
+  for (j=0; j<2; ++j) {
+    if (k+j<=0) { c[j]=0; continue; }
+    if (k+j>=nshards) { c[j]=ck->n; continue; }
+    // First checkpoint at or after the target position
+    target = start + (total*(k+j))/nshards;
+    lo = 0; hi = ck->n;
+    while (lo<hi) {
+      mid = (lo+hi)/2;
+      if (ck->offset[mid]<target) lo = mid+1;
+      else hi = mid;
+    }
+    c[j] = lo;
+  }
+
+  *first = MINIMUM(c[0]*ck->every, ck->nrec);
+  return MINIMUM(c[1]*ck->every, ck->nrec) - *first;
+}
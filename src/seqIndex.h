@@ -0,0 +1,84 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef SEQINDEX_H
+#define SEQINDEX_H
+
+/*
+  Index of the records of a fasta or fastq file by name
+
+  The index has the file position of every record (of the '>' or '@'
+  starting it) and the names in an idDict with a hash, so a record is
+  found by name and read directly. It is built in one pass where chunks
+  of the file are parsed by inThreads workers (using the usual readers,
+  so the id is the same as from readFasta_fileBuffer etc).
+
+  The index file contains
+    magic string "akseqix2"
+    array of 3 longs: type ('>' or '@'), number of records n and the
+                   size of the indexed file
+    offsets        array of n+1 file positions (the last is the file size)
+    the names      as written by write_idDict
+  and is memory mapped when opened, so it is ready at once for any size.
+  load_seqIndex builds the index again if the size of the sequence file
+  is not the one in the index file.
+
+  A checkpointIndex only has the file position of every Nth record, and
+  is filled while the file is read anyway (with read_checkpointIndex).
+  With it a reader can start at any record (seek_checkpointIndex), and
+  the file can be split in shards of about the same size for parallel
+  workers (shard_checkpointIndex). The file must be seekable (not
+  compressed). The checkpoint file contains
+    magic string "akckpt01"
+    array of 4 longs: type, N, number of records and number of checkpoints m
+    offsets        array of m+1 file positions (the last is the end)
+
+  Include akstandard.h (or inThreads.h), simpleHash.h, fileBuffer.h,
+  sequence.h, parallelReader.h and idDict.h before this file.
+*/
+
+#define SEQINDEX_MAGIC "akseqix2"
+
+typedef struct {
+  int type;               // '>' for fasta or '@' for fastq
+  long n;                 // Number of records
+  long *offset;           // File position of each record (offset[n] is the end)
+  idDict *names;
+  fileBuffer *map;        // The mapped index file (NULL if built)
+} seqIndex;
+
+
+typedef struct {
+  int type;               // '>' for fasta or '@' for fastq
+  long every;             // N: there is a checkpoint for every N'th record
+  long nrec;              // Number of records
+  long n;                 // Number of checkpoints
+  long nalloc;
+  long *offset;           // File position of records 0, N, 2N, ... (offset[n] is the end)
+} checkpointIndex;
+
+
+seqIndex *build_seqIndex(FILE *fp, int type, AlphabetStruct *alph, int nthreads);
+void write_seqIndex(seqIndex *ix, char *filename);
+seqIndex *open_seqIndex(char *filename);
+seqIndex *load_seqIndex(char *seqfile, int type, AlphabetStruct *alph, int nthreads, int write);
+void free_seqIndex(seqIndex *ix);
+long lookup_seqIndex(seqIndex *ix, char *name);
+Sequence *fetch_seqIndex(seqIndex *ix, FILE *fp, long i, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+			 int save_descr);
+Sequence *fetch_seqIndex_mmap(seqIndex *ix, fileBuffer *fb, long i, AlphabetStruct *seq_alph,
+			      AlphabetStruct *qual_alph, int save_descr);
+checkpointIndex *alloc_checkpointIndex(int type, long every);
+void free_checkpointIndex(checkpointIndex *ck);
+Sequence *read_checkpointIndex(checkpointIndex *ck, fileBuffer *fb, AlphabetStruct *seq_alph,
+			       AlphabetStruct *qual_alph, int save_descr);
+checkpointIndex *checkpoints_seqIndex(seqIndex *ix, long every);
+void write_checkpointIndex(checkpointIndex *ck, char *filename);
+checkpointIndex *read_checkpointIndex_file(char *filename);
+fileBuffer *seek_checkpointIndex(checkpointIndex *ck, FILE *fp, long record, AlphabetStruct *alph);
+long shard_checkpointIndex(checkpointIndex *ck, int k, int nshards, long *first);
+
+#endif
@@ -8,13 +8,16 @@ aklib licensed under the GPLv3, see the file LICENSE.
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "akstandard.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "simdKernels.h"
 #include "sequence.h"
 
 
-Sequence *alloc_Sequence() {
-  Sequence *ss=(Sequence *)malloc(sizeof(Sequence));
+static void init_Sequence(Sequence *ss) {
   ss->len = 0;
   ss->flag = 0;
   ss->pos = 0;
@@ -23,8 +26,14 @@ Sequence *alloc_Sequence() {
   ss->s = NULL;
   ss->lab=NULL;
   ss->q=NULL;
+  ss->counts=NULL;
   ss->sort_order = 0;
   ss->next=NULL;
+}
+
+Sequence *alloc_Sequence() {
+  Sequence *ss=(Sequence *)malloc(sizeof(Sequence));
+  init_Sequence(ss);
   return ss;
 }
 
@@ -35,10 +44,17 @@ void free_Sequence(Sequence *ss) {
     if (ss->s && checkBit(ss->flag,seq_flag_seq) ) free(ss->s);
     if (ss->lab && checkBit(ss->flag,seq_flag_lab) ) free(ss->lab);
     if (ss->q && checkBit(ss->flag,seq_flag_q) ) free(ss->q);
+    if (ss->counts && checkBit(ss->flag,seq_flag_counts) ) free(ss->counts);
     free(ss);
   }
 }
 
+// Free a linked list of sequences (in seq->next)
+void free_Sequence_list(Sequence *seq) {
+  Sequence *next;
+  while (seq) { next = seq->next; free_Sequence(seq); seq = next; }
+}
+
 
 
 /* Makes a translation table from an alphabet to a translation, so
@@ -485,10 +501,128 @@ void print_AlphabetStruct(AlphabetStruct *a, FILE *fp) {
 
 /*
   translate a sequence (s) to numbers
+  (vectorized if possible, see simdKernels.c)
  */
 void translate2numbers(char *s, const long slen, AlphabetStruct *astruct) {
-  long k;
-  for (k=0;k<slen;++k) s[k]=astruct->trans[(int)s[k]];
+  translate_bytes(s, slen, astruct->trans);
+}
+
+
+
+/*************************************************
+
+Composition statistics
+
+The residues are counted with the vectorized histogram in simdKernels.
+translate_seqStats does the translation and the counting in the same
+pass, and is used by the readers when they are given a seqStats, so the
+statistics cost no extra pass over the data. Counts from several
+threads (each with its own seqStats) are added with merge_seqStats.
+
+  seqStats st;
+  init_seqStats(&st,dna);
+  while ( (seq=readFastaStats_fileBuffer(fb,dna,1,&st)) ) {
+    gc = gc_seqStats(st.seqcounts,dna);
+    ...
+  }
+  printf("N's: %ld of %ld\n",st.counts[(int)dna->trans['N']],st.total);
+
+seqcounts only has the last sequence. When sequences are read in batches
+or by parallel readers, set st.keep_counts, and each sequence gets its
+own counts in seq->counts (freed with the sequence, or part of the
+seqBatch):
+
+  pr->stats = &st;
+  st.keep_counts = 1;
+  while ( (seq=readSequence_parallelReader(pr)) ) {
+    gc = gc_seqStats(seq->counts,dna);
+
+*************************************************/
+
+static pthread_mutex_t seqStats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void init_seqStats(seqStats *st, AlphabetStruct *alph) {
+  memset(st, 0, sizeof(seqStats));
+  st->ncounts = MINIMUM(alph->len, SEQSTATS_MAXALPH);
+  st->minlen = -1;
+}
+
+
+// Add the last sequence (in seqlen and seqcounts) to the totals
+static void add_seqStats(seqStats *st) {
+  long len = st->seqlen;
+  int c, b=0;
+
+  st->nseq += 1;
+  st->total += len;
+  if (st->minlen<0 || len<st->minlen) st->minlen = len;
+  if (len>st->maxlen) st->maxlen = len;
+  while (len>0) { ++b; len >>= 1; }
+  st->lenhist[b] += 1;
+  for (c=0; c<st->ncounts; ++c) st->counts[c] += st->seqcounts[c];
+}
+
+
+// Count a sequence (already translated to numbers)
+void count_seqStats(seqStats *st, char *s, long len) {
+  memset(st->seqcounts, 0, st->ncounts*sizeof(long));
+  st->seqlen = len;
+  translate_count_bytes(s, len, NULL, st->seqcounts, st->ncounts);
+  add_seqStats(st);
+}
+
+
+// Translate s as translate2numbers and count it
+void translate_seqStats(seqStats *st, char *s, long len, AlphabetStruct *alph) {
+  memset(st->seqcounts, 0, st->ncounts*sizeof(long));
+  st->seqlen = len;
+  translate_count_bytes(s, len, alph->trans, st->seqcounts, st->ncounts);
+  add_seqStats(st);
+}
+
+
+// Give seq a copy of the counts of the last sequence (if st->keep_counts)
+void keep_seqStats(seqStats *st, Sequence *seq) {
+  if (!st->keep_counts) return;
+  seq->counts = (long *)malloc(st->ncounts*sizeof(long));
+  memcpy(seq->counts, st->seqcounts, st->ncounts*sizeof(long));
+  setBit(seq->flag,seq_flag_counts);
+}
+
+
+// Add the counts of from to to (can be called from several threads)
+void merge_seqStats(seqStats *to, seqStats *from) {
+  int c;
+
+  pthread_mutex_lock(&seqStats_lock);
+  if (from->nseq>0) {
+    if (to->minlen<0 || (from->minlen>=0 && from->minlen<to->minlen)) to->minlen = from->minlen;
+    if (from->maxlen>to->maxlen) to->maxlen = from->maxlen;
+  }
+  to->nseq += from->nseq;
+  to->total += from->total;
+  for (c=0; c<to->ncounts && c<from->ncounts; ++c) to->counts[c] += from->counts[c];
+  for (c=0; c<SEQSTATS_LENBINS; ++c) to->lenhist[c] += from->lenhist[c];
+  pthread_mutex_unlock(&seqStats_lock);
+}
+
+
+/*
+  Fraction of G and C among A, C, G and T/U (either case) in counts
+  (counts or seqcounts of a seqStats). Returns 0 if there are none.
+*/
+double gc_seqStats(long *counts, AlphabetStruct *alph) {
+  long gc=0, all=0;
+  int i, c;
+
+  for (i=0; i<alph->len && i<SEQSTATS_MAXALPH; ++i) {
+    c = toupper(alph->a[i]);
+    if ( c=='G' || c=='C' ) gc += counts[i];
+    if ( c=='A' || c=='C' || c=='G' || c=='T' || c=='U' ) all += counts[i];
+  }
+  if (all==0) return 0.;
+  return (double)gc/all;
 }
 
 
@@ -613,19 +747,29 @@ int ReadSequenceFileHeader(FILE *fp, int type) {
 
 /* When reading an iString it takes an array of letters to include
    This array includes all letters A-Z,a-z
+   (it has 256 entries, so it can be indexed by any unsigned char)
+   It is a constant table, so the readers can be used from several threads
  */
-static char *make_readInclude() {
-  int i;
-  static int done=0;
-  static char z[128];
-  if (!done) {
-    for (i=0; i<128; ++i) z[i]=0;
-    for (i='A'; i<'Z'; ++i) z[i]=1;
-    for (i='a'; i<'z'; ++i) z[i]=1;
-    done =1;
-  }
-  return z;
-}
+static char readInclude_table[256] = {
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+  1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,
+  0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+  1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
+static char *make_readInclude() { return readInclude_table; }
 
 
 
@@ -641,10 +785,8 @@ Sequence *readFasta(FILE *fp, AlphabetStruct *alph, int read_size, int save_desc
   int c;
   iString *is;
   Sequence *seq;
-  static char *readInclude = NULL;
+  char *readInclude = make_readInclude();
 
-  if (!readInclude) readInclude = make_readInclude();
- 
   // Last call reached EOF
   if (*eof) return NULL;
 
@@ -680,9 +822,7 @@ Sequence *readFastq(FILE *fp, AlphabetStruct *seq_alph, AlphabetStruct *qual_alp
   int i, n;
   iString *is;
   Sequence *seq;
-  static char *readInclude = NULL;
-
-  if (!readInclude) readInclude = make_readInclude();
+  char *readInclude = make_readInclude();
 
   // Last call reached EOF
   if (*eof) return NULL;
@@ -748,6 +888,954 @@ Sequence *readFastq(FILE *fp, AlphabetStruct *seq_alph, AlphabetStruct *qual_alp
 
 
 
+/*************************************************
+
+Block buffered reading of fasta and fastq
+
+These functions do the same as ReadSequenceFileHeader, readFasta and
+readFastq, but they read from a fileBuffer. Line ends are found with
+memchr and whole lines are copied at once instead of reading a char at
+a time with fgetc.
+
+The sequence is returned in the same form as by readFasta/readFastq.
+
+Usage:
+  fileBuffer *fb = alloc_fileBuffer(fp,0);
+  if ( ReadSequenceFileHeader_fileBuffer(fb,'>') )
+    while ( (seq=readFasta_fileBuffer(fb,alph,1)) ) { ...; free_Sequence(seq); }
+  free_fileBuffer(fb);
+
+*************************************************/
+
+
+// As ReadSequenceFileHeader
+int ReadSequenceFileHeader_fileBuffer(fileBuffer *fb, int type) {
+  int c;
+
+  c = peek_fileBuffer(fb);
+  while ( c=='#' || c=='\n' || c==' ' || c=='\t' ) {
+    skip_line_fileBuffer(fb);
+    c = peek_fileBuffer(fb);
+  }
+  if (c==EOF) return 0;
+
+  if ( c=='>' || c=='@' ) fb->pos += 1;
+
+  if (type) {
+    if ( type != 'l' && type != c ) {
+      fprintf(stderr,"ReadSequenceFileHeader_fileBuffer: Found letter %c in beginning of file, where %c ",c,type);
+      ERROR("was expected",1);
+    }
+  }
+  else {
+    type = 's';
+    if ( c=='>' || c=='@' ) type = c;
+  }
+
+  return type;
+}
+
+
+/* Set id (and descr) from a header line of length n in the same way
+   as read___ID
+
+   If inplace!=0 the id (and descr) points into line, which is changed
+   (0 terminated). In this case line[n] must be writable (normally the
+   newline).
+*/
+static void set_ID_from_line(Sequence *seq, char *line, long n, int save_descr, int inplace) {
+  long i;
+
+  if (save_descr) {
+    if (n==0) return;
+    if (inplace) seq->id = line;
+    else {
+      seq->id = (char *)malloc((n+1)*sizeof(char));
+      memcpy(seq->id,line,n);
+    }
+    seq->id[n] = '\0';
+    // Find first space:
+    for (i=0; i<n; ++i) if ( isspace(seq->id[i]) ) break;
+    if (i<n) {
+      seq->id[i++]='\0';
+      for ( ; i<n; ++i) if ( !isspace(seq->id[i]) ) break;
+      if (i<n) seq->descr = seq->id+i;
+    }
+  }
+  else {
+    // ID is until first space
+    for (i=0; i<n; ++i) if ( line[i]==' ' ) break;
+    if (i==0) return;
+    if (inplace) { line[i]='\0'; seq->id = line; }
+    else seq->id = strndup(line,i);
+  }
+  if (!inplace) toggleBit(seq->flag,seq_flag_id);
+}
+
+
+/*
+  Copy a line of length n to d (they may overlap if d<=line).
+  The line is copied at once, and chars that are not included are
+  removed afterwards (normally there are none).
+  Returns the number of chars in d.
+*/
+static long copy_line_letters(char *d, char *line, long n, char *include) {
+  long i, k;
+
+  memmove(d,line,n);
+  for (i=0; i<n; ++i) if ( !include[(uchar)d[i]] ) break;
+  for (k=i; i<n; ++i) { d[k] = d[i]; k += include[(uchar)d[i]]; }
+
+  return k;
+}
+
+
+/*
+  Append a line of length n to s (currently of length l and allocated size *alloc)
+  Returns the new length.
+*/
+static long append_line(char **s, long *alloc, long l, char *line, long n, char *include) {
+  if ( l+n > *alloc ) {
+    while ( l+n > *alloc ) *alloc *= 2;
+    *s = (char *)realloc(*s, *alloc*sizeof(char));
+  }
+  return l+copy_line_letters(*s+l, line, n, include);
+}
+
+
+/*
+  Append sequence lines to s (of length *l and allocated size *alloc)
+  until a line starting with stopchar (which is not read).
+  Returns the stopchar or EOF
+*/
+static int append_seqlines(fileBuffer *fb, char **s, long *alloc, long *l, int stopchar, char *include) {
+  long n;
+  char *line;
+  int c;
+
+  while ( (c=peek_fileBuffer(fb))!=EOF && c!=stopchar ) {
+    line = next_line_fileBuffer(fb,&n);
+    *l = append_line(s, alloc, *l, line, n, include);
+  }
+  return c;
+}
+
+
+/*
+  Read sequence lines until a line starting with stopchar (which is not read).
+  Sets seq->s and seq->len (but does not translate)
+  Returns the stopchar or EOF
+*/
+static int read_seqlines_fileBuffer(fileBuffer *fb, Sequence *seq, int stopchar, char *include) {
+  long alloc=1024;
+  int c;
+
+  seq->len = 0;
+  seq->s = (char *)malloc(alloc*sizeof(char));
+  c = append_seqlines(fb, &(seq->s), &alloc, &(seq->len), stopchar, include);
+
+  if (seq->len) {
+    seq->s = (char *)realloc(seq->s, seq->len*sizeof(char));
+    toggleBit(seq->flag,seq_flag_seq);
+  }
+  else { free(seq->s); seq->s=NULL; }
+
+  return c;
+}
+
+
+/*
+  Read len quality scores from the lines following the '+' line.
+  If qual_alph==NULL they are skipped, otherwise they are translated into q.
+  Chars that are not in the alphabet (translated to <=0) are ignored.
+  Returns the number read (less than len on EOF)
+*/
+static long read_quality_lines(fileBuffer *fb, char *q, long len, AlphabetStruct *qual_alph) {
+  long i, k, n=0, l;
+  int c, t;
+  char *line;
+
+  while ( n<len && (line=next_line_fileBuffer(fb,&l)) ) {
+    k = MINIMUM(l,len-n);
+    if (!qual_alph) { n += k; continue; }
+    // Translate the whole line, and check that all are valid
+    memcpy(q+n,line,k);
+    translate2numbers(q+n, k, qual_alph);
+    for (i=0; i<k; ++i) if ( q[n+i]<=0 ) break;
+    if (i==k) { n += k; continue; }
+    // Otherwise only keep chars in alphabet
+    for (i=0; i<l && n<len; ++i) {
+      c = (uchar)line[i];
+      if ( c<128 && (t=qual_alph->trans[c])>0 ) q[n++] = t;
+    }
+  }
+  return n;
+}
+
+
+// Skip lines until one starting with '@' and read the '@'
+static void skip_to_next_fastq(fileBuffer *fb) {
+  int c;
+  while ( (c=peek_fileBuffer(fb))!=EOF && c!='@' ) skip_line_fileBuffer(fb);
+  if (c=='@') fb->pos += 1;
+}
+
+
+/*
+  Read a fasta record (fb after the '>'). Letters not in readInclude are
+  left out of the sequence, and it is counted in st if not NULL.
+*/
+static Sequence *read_fasta_record(fileBuffer *fb, AlphabetStruct *alph, int save_descr, seqStats *st, char *readInclude) {
+  long n;
+  char *line;
+  Sequence *seq;
+
+  line = next_line_fileBuffer(fb,&n);
+  if (!line) return NULL;
+
+  seq = alloc_Sequence();
+  set_ID_from_line(seq, line, n, save_descr, 0);
+
+  if ( read_seqlines_fileBuffer(fb, seq, '>', readInclude) == '>' ) fb->pos += 1;
+  if (st) {
+    translate_seqStats(st, (char *)seq->s, seq->len, alph);
+    keep_seqStats(st, seq);
+  }
+  else if (seq->len) translate2numbers((char *)seq->s, seq->len, alph);
+
+  return seq;
+}
+
+
+// As read_fasta_record for fastq
+static Sequence *read_fastq_record(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr,
+				   seqStats *st, char *readInclude) {
+  long n;
+  int c;
+  char *line;
+  Sequence *seq;
+
+  line = next_line_fileBuffer(fb,&n);
+  if (!line) return NULL;
+
+  seq = alloc_Sequence();
+  set_ID_from_line(seq, line, n, save_descr, 0);
+
+  // Read sequence until next '\n+'
+  c = read_seqlines_fileBuffer(fb, seq, '+', readInclude);
+  if (c==EOF) ERROR("File ended in the middle og fastq entry",1);
+  skip_line_fileBuffer(fb);
+
+  if (st) {
+    translate_seqStats(st, (char *)seq->s, seq->len, seq_alph);
+    keep_seqStats(st, seq);
+  }
+  if (seq->len) {
+    if (!st) translate2numbers((char *)seq->s, seq->len, seq_alph);
+    // Read qual scores
+    if (qual_alph) {
+      seq->q = (char *)malloc(seq->len*sizeof(char));
+      toggleBit(seq->flag,seq_flag_q);
+    }
+    if ( read_quality_lines(fb, seq->q, seq->len, qual_alph) < seq->len ) {
+      fprintf(stderr,"For sequence %s\n",seq->id);
+      ERROR("EOF reached before quality sequence was complete",1);
+    }
+  }
+
+  skip_to_next_fastq(fb);
+
+  return seq;
+}
+
+
+/*
+  As readFasta, but from a fileBuffer. fb must be at the first position of
+  the id (after '>'), see ReadSequenceFileHeader_fileBuffer.
+  Returns NULL on EOF.
+*/
+Sequence *readFasta_fileBuffer(fileBuffer *fb, AlphabetStruct *alph, int save_descr) {
+  return readFastaStats_fileBuffer(fb, alph, save_descr, NULL);
+}
+
+
+// As readFasta_fileBuffer, and the sequence is counted in st (if not NULL)
+Sequence *readFastaStats_fileBuffer(fileBuffer *fb, AlphabetStruct *alph, int save_descr, seqStats *st) {
+  return read_fasta_record(fb, alph, save_descr, st, make_readInclude());
+}
+
+
+/*
+  As readFastq, but from a fileBuffer. fb must be at the first position of
+  the id (after '@').
+  Returns NULL on EOF.
+*/
+Sequence *readFastq_fileBuffer(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr) {
+  return readFastqStats_fileBuffer(fb, seq_alph, qual_alph, save_descr, NULL);
+}
+
+
+// As readFastq_fileBuffer, and the sequence is counted in st (if not NULL)
+Sequence *readFastqStats_fileBuffer(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr,
+				    seqStats *st) {
+  return read_fastq_record(fb, seq_alph, qual_alph, save_descr, st, make_readInclude());
+}
+
+
+
+/*************************************************
+
+Reader contexts
+
+A seqReader has all the state of reading one fasta or fastq stream (the
+fileBuffer, the letters included in sequences, eof etc), so readers of
+different streams can be used in different threads at the same time.
+
+  seqReader *r = alloc_seqReader(alloc_fileBuffer(fp,0),0,dna,qual,0);
+  while ( (seq=read_seqReader(r)) ) {
+    ...
+  }
+  free_seqReader(r);
+
+With type=0 the type is found from the first record. The letters read
+can be changed in r->include (e.g. r->include['*']=1 for stop codons).
+
+*************************************************/
+
+
+/*
+  The fileBuffer is freed by free_seqReader (the stream is not closed).
+  type is '>', '@' or 0 (found from the file).
+*/
+seqReader *alloc_seqReader(fileBuffer *fb, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr) {
+  seqReader *r = (seqReader *)malloc(sizeof(seqReader));
+  int t;
+
+  r->fb = fb;
+  r->seq_alph = seq_alph;
+  r->qual_alph = qual_alph;
+  r->save_descr = save_descr;
+  r->nread = 0;
+  r->stats = NULL;
+  memcpy(r->include, make_readInclude(), 256);
+
+  t = ReadSequenceFileHeader_fileBuffer(fb, type);
+  if ( t=='s' ) ERROR("alloc_seqReader: The file is neither fasta nor fastq",1);
+  r->type = (t ? t : type);
+  r->eof = (t==0);
+
+  return r;
+}
+
+
+// Returns the next sequence or NULL at the end
+Sequence *read_seqReader(seqReader *r) {
+  Sequence *seq;
+
+  if (r->eof) return NULL;
+  if (r->type=='@') seq = read_fastq_record(r->fb, r->seq_alph, r->qual_alph, r->save_descr, r->stats, r->include);
+  else seq = read_fasta_record(r->fb, r->seq_alph, r->save_descr, r->stats, r->include);
+  if (seq) r->nread += 1;
+  else r->eof = 1;
+
+  return seq;
+}
+
+
+void free_seqReader(seqReader *r) {
+  if (r) {
+    free_fileBuffer(r->fb);
+    free(r);
+  }
+}
+
+
+/*
+  Read fasta from a fileBuffer that holds the whole file in writable memory,
+  e.g. from mmap_fileBuffer(filename,1). Nothing is copied: the id, descr
+  and sequence of the returned Sequence point into the buffer, where the
+  sequence lines are moved together and translated in place.
+
+  The flags of the Sequence mark id, descr and s as not allocated, so
+  free_Sequence does not free them, but the fileBuffer must not be freed
+  before the sequences are no longer used.
+
+  For a private file mapping only the pages that are changed are copied,
+  so memory use is at most one copy of the file.
+
+  fb must be at the first position of the id (after '>').
+  Returns NULL on EOF.
+*/
+Sequence *readFasta_inplace(fileBuffer *fb, AlphabetStruct *alph, int save_descr) {
+  char *p, *eol, *d, *end;
+  Sequence *seq;
+  char *readInclude = make_readInclude();
+
+  if ( fb->fill || !checkBit(fb->flag,FB_writable) ) {
+    ERROR("readFasta_inplace: The whole file must be in a writable fileBuffer",1);
+  }
+  if (fb->pos>=fb->len) return NULL;
+
+  end = fb->buf+fb->len;
+  p = fb->buf+fb->pos;
+  seq = alloc_Sequence();
+
+  // ID line
+  eol = (char *)memchr(p, '\n', end-p);
+  if (!eol) {
+    // Last line has no newline to hold the terminating 0, so id is copied
+    set_ID_from_line(seq, p, end-p, save_descr, 0);
+    fb->pos = fb->len;
+    return seq;
+  }
+  set_ID_from_line(seq, p, eol-p, save_descr, 1);
+  p = eol+1;
+
+  // Move sequence lines together
+  seq->s = d = p;
+  while ( p<end && *p!='>' ) {
+    eol = (char *)memchr(p, '\n', end-p);
+    if (!eol) eol = end;
+    d += copy_line_letters(d, p, eol-p, readInclude);
+    p = eol;
+    if (p<end) ++p;
+  }
+  if (p<end) ++p;    // Skip '>'
+  fb->pos = p-fb->buf;
+
+  seq->len = d-seq->s;
+  if (seq->len) translate2numbers((char *)seq->s, seq->len, alph);
+  else seq->s = NULL;
+
+  return seq;
+}
+
+
+
+/*************************************************
+
+Reading sequences in batches
+
+All sequences of a batch are in one array, and their ids, descriptions,
+residues and quality scores are in one arena, so a batch costs a couple
+of allocations instead of several per sequence. The Sequences must NOT
+be freed with free_Sequence - the whole batch is freed with free_seqBatch.
+
+A batch can be reused: read_seqBatch overwrites the previous content and
+keeps the allocations.
+
+Usage:
+  seqBatch *b = alloc_seqBatch();
+  ReadSequenceFileHeader_fileBuffer(fb,'@');
+  while ( read_seqBatch(b,fb,'@',dna,qual,0,10000,0) ) {
+    for (i=0; i<b->n; ++i) do_something(b->seq+i);
+  }
+  free_seqBatch(b);
+
+If the ids are rarely used (as for most short-read jobs), set
+b->lazy_id=1. The header lines are then only copied to the arena, and
+id_seqBatch(b,i) and descr_seqBatch(b,i) split the header when they are
+called. seq->id and seq->descr are NULL until then.
+
+*************************************************/
+
+
+seqBatch *alloc_seqBatch() {
+  seqBatch *b = (seqBatch *)malloc(sizeof(seqBatch));
+  b->n = b->nalloc = 0;
+  b->seq = NULL;
+  b->offsets = NULL;
+  b->used = 0;
+  b->size = (1<<20);
+  b->arena = (char *)malloc(b->size*sizeof(char));
+  b->stats = NULL;
+  b->counts = NULL;
+  b->countsize = 0;
+  b->lazy_id = 0;
+  return b;
+}
+
+
+void free_seqBatch(seqBatch *b) {
+  if (b) {
+    if (b->seq) free(b->seq);
+    if (b->offsets) free(b->offsets);
+    if (b->arena) free(b->arena);
+    if (b->counts) free(b->counts);
+    free(b);
+  }
+}
+
+
+// Copy the counts of the last sequence in b->stats to the counts of sequence b->n
+static void keep_counts_seqBatch(seqBatch *b) {
+  int nc = b->stats->ncounts;
+  if ( (b->n+1)*nc > b->countsize ) {
+    b->countsize = b->nalloc*nc;
+    b->counts = (long *)realloc(b->counts, b->countsize*sizeof(long));
+  }
+  memcpy(b->counts+b->n*nc, b->stats->seqcounts, nc*sizeof(long));
+}
+
+
+// Make room for n more bytes in the arena
+static inline char *reserve_seqBatch(seqBatch *b, long n) {
+  if ( b->used+n > b->size ) {
+    while ( b->used+n > b->size ) b->size *= 2;
+    b->arena = (char *)realloc(b->arena, b->size*sizeof(char));
+  }
+  return b->arena+b->used;
+}
+
+
+/*
+  Read the header line into the arena. The id (and descr) are stored as
+  offsets, because the arena may move.
+*/
+static void read_ID_seqBatch(seqBatch *b, long *offsets, char *line, long n, int save_descr) {
+  long i;
+  char *id;
+  Sequence tmp;
+
+  if (!save_descr) {
+    for (i=0; i<n; ++i) if ( line[i]==' ' ) break;
+    n = i;
+    if (n==0) return;
+  }
+  else if (n==0) return;
+
+  id = reserve_seqBatch(b, n+1);
+  memcpy(id, line, n);
+  id[n] = '\0';
+  offsets[0] = b->used;
+  if (save_descr) {
+    init_Sequence(&tmp);
+    set_ID_from_line(&tmp, id, n, 1, 1);
+    if (tmp.descr) offsets[1] = b->used + (tmp.descr-id);
+  }
+  b->used += n+1;
+}
+
+
+// Lazy: the header line is only copied (offsets[1] is its length)
+static void read_header_seqBatch(seqBatch *b, long *offsets, char *line, long n) {
+  char *h;
+
+  if (n==0) return;
+  h = reserve_seqBatch(b, n+1);
+  memcpy(h, line, n);
+  h[n] = '\0';
+  offsets[0] = b->used;
+  offsets[1] = n;
+  b->used += n+1;
+}
+
+
+// Set id and descr of sequence i from the header stored by a lazy read
+static void parse_ID_seqBatch(seqBatch *b, int i) {
+  Sequence *seq = b->seq+i;
+  long *offsets = b->offsets+4*i;
+
+  if ( !b->lazy_id || seq->id || offsets[0]<0 ) return;
+  set_ID_from_line(seq, b->arena+offsets[0], offsets[1], 1, 1);
+}
+
+
+/*
+  The id of sequence i in the batch (NULL if there is none). If the batch
+  was read with lazy_id, the header line is split into id and descr (in
+  place) the first time id or descr is asked for.
+*/
+char *id_seqBatch(seqBatch *b, int i) {
+  parse_ID_seqBatch(b, i);
+  return b->seq[i].id;
+}
+
+
+// As id_seqBatch for descr. With lazy_id, descr is there even if save_descr=0
+char *descr_seqBatch(seqBatch *b, int i) {
+  parse_ID_seqBatch(b, i);
+  return b->seq[i].descr;
+}
+
+
+/*
+  Read up to maxseq sequences or until maxbytes have been used for data
+  (whichever comes first; a value <=0 means no limit) of type '>' (fasta)
+  or '@' (fastq) into the batch.
+  fb must be at the first position of an id (as for readFasta_fileBuffer)
+
+  Returns the number of sequences read (0 at EOF)
+*/
+int read_seqBatch(seqBatch *b, fileBuffer *fb, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+		  int save_descr, int maxseq, long maxbytes) {
+  long i, n, l, *offsets;
+  char *line;
+  int c;
+  Sequence *seq;
+  char *readInclude = make_readInclude();
+
+  if ( type!='>' && type!='@' ) ERROR("read_seqBatch: type must be '>' or '@'",1);
+
+  b->n = 0;
+  b->used = 0;
+
+  while ( (maxseq<=0 || b->n<maxseq) && (maxbytes<=0 || b->used<maxbytes) ) {
+    line = next_line_fileBuffer(fb,&n);
+    if (!line) break;
+
+    if (b->n==b->nalloc) {
+      b->nalloc = (b->nalloc ? 2*b->nalloc : 1024);
+      b->seq = (Sequence *)realloc(b->seq, b->nalloc*sizeof(Sequence));
+      b->offsets = (long *)realloc(b->offsets, 4*b->nalloc*sizeof(long));
+    }
+    seq = b->seq+b->n;
+    init_Sequence(seq);
+    // Offsets of id, descr, s and q
+    offsets = b->offsets+4*b->n;
+    for (i=0; i<4; ++i) offsets[i] = -1;
+
+    if (b->lazy_id) read_header_seqBatch(b, offsets, line, n);
+    else read_ID_seqBatch(b, offsets, line, n, save_descr);
+
+    // Sequence
+    offsets[2] = l = b->used;
+    c = append_seqlines(fb, &(b->arena), &(b->size), &(b->used), (type=='@'?'+':'>'), readInclude);
+    seq->len = b->used-l;
+    if (b->stats) {
+      translate_seqStats(b->stats, b->arena+l, seq->len, seq_alph);
+      if (b->stats->keep_counts) keep_counts_seqBatch(b);
+    }
+    else if (seq->len) translate2numbers(b->arena+l, seq->len, seq_alph);
+    if (seq->len==0) offsets[2] = -1;
+
+    if (type=='>') {
+      if (c=='>') fb->pos += 1;
+    }
+    else {
+      if (c==EOF) ERROR("File ended in the middle og fastq entry",1);
+      skip_line_fileBuffer(fb);
+      if (seq->len) {
+	if (qual_alph) {
+	  reserve_seqBatch(b, seq->len);
+	  offsets[3] = b->used;
+	}
+	if ( read_quality_lines(fb, (qual_alph?b->arena+b->used:NULL), seq->len, qual_alph) < seq->len ) {
+	  if (offsets[0]>=0) fprintf(stderr,"For sequence %s\n",b->arena+offsets[0]);
+	  ERROR("EOF reached before quality sequence was complete",1);
+	}
+	if (qual_alph) b->used += seq->len;
+      }
+      skip_to_next_fastq(fb);
+    }
+
+    b->n += 1;
+  }
+
+  // Now the arena does not move anymore, so pointers can be set
+  for (i=0; i<b->n; ++i) {
+    seq = b->seq+i;
+    offsets = b->offsets+4*i;
+    if (!b->lazy_id) {
+      if (offsets[0]>=0) seq->id = b->arena+offsets[0];
+      if (offsets[1]>=0) seq->descr = b->arena+offsets[1];
+    }
+    if (offsets[2]>=0) seq->s = b->arena+offsets[2];
+    if (offsets[3]>=0) seq->q = b->arena+offsets[3];
+    if (b->stats && b->stats->keep_counts) seq->counts = b->counts+i*b->stats->ncounts;
+    if (i+1<b->n) seq->next = seq+1;
+  }
+
+  return b->n;
+}
+
+
+
+/*************************************************
+
+Indexed fasta files
+
+The index has the same format as the .fai files of samtools: a line per
+sequence with name, length, offset of the first residue, residues per
+line and bytes per line (including the newline). With the index a region
+of a sequence can be read directly, because all lines of a sequence
+(except the last) have the same length.
+
+Usage:
+  faiIndex *fai = load_faiIndex("genome.fa",1);
+  FILE *fp = fopen("genome.fa","r");
+  seq = fetch_faiIndex(fai, fp, "chr2", 1000000, 1005000, dna);
+  ...
+  free_Sequence(seq);
+  free_faiIndex(fai);
+
+Regions are 0-based and the end is not included. If the file is memory
+mapped with mmap_fileBuffer, use fetch_faiIndex_mmap instead.
+
+*************************************************/
+
+
+static faiIndex *alloc_faiIndex() {
+  faiIndex *fai = (faiIndex *)malloc(sizeof(faiIndex));
+  fai->n = 0;
+  fai->nalloc = 256;
+  fai->name = (char **)malloc(fai->nalloc*sizeof(char *));
+  fai->len = (long *)malloc(fai->nalloc*sizeof(long));
+  fai->offset = (long *)malloc(fai->nalloc*sizeof(long));
+  fai->linebases = (int *)malloc(fai->nalloc*sizeof(int));
+  fai->linewidth = (int *)malloc(fai->nalloc*sizeof(int));
+  fai->hash = NULL;
+  return fai;
+}
+
+
+void free_faiIndex(faiIndex *fai) {
+  int i;
+  if (fai) {
+    for (i=0; i<fai->n; ++i) free(fai->name[i]);
+    free(fai->name);
+    free(fai->len);
+    free(fai->offset);
+    free(fai->linebases);
+    free(fai->linewidth);
+    if (fai->hash) stringHash_free(fai->hash);
+    free(fai);
+  }
+}
+
+
+// Add an entry (the name is copied)
+static void add_faiIndex(faiIndex *fai, char *name, long n, long offset) {
+  if (fai->n==fai->nalloc) {
+    fai->nalloc *= 2;
+    fai->name = (char **)realloc(fai->name, fai->nalloc*sizeof(char *));
+    fai->len = (long *)realloc(fai->len, fai->nalloc*sizeof(long));
+    fai->offset = (long *)realloc(fai->offset, fai->nalloc*sizeof(long));
+    fai->linebases = (int *)realloc(fai->linebases, fai->nalloc*sizeof(int));
+    fai->linewidth = (int *)realloc(fai->linewidth, fai->nalloc*sizeof(int));
+  }
+  fai->name[fai->n] = strndup(name,n);
+  fai->len[fai->n] = 0;
+  fai->offset[fai->n] = offset;
+  fai->linebases[fai->n] = fai->linewidth[fai->n] = 0;
+  fai->n += 1;
+}
+
+
+// Make the hash for name lookup
+static void hash_faiIndex(faiIndex *fai) {
+  long i;
+  fai->hash = stringHash_alloc(2*fai->n+1);
+  for (i=0; i<fai->n; ++i) stringHash_insert(fai->name[i], (void *)(i+1), fai->hash);
+}
+
+
+/*
+  Make the index of a fasta file by reading all of it from the current
+  position of fp. It is an error if the lines of a sequence (except the
+  last) do not have the same length.
+*/
+faiIndex *build_faiIndex(FILE *fp) {
+  faiIndex *fai = alloc_faiIndex();
+  fileBuffer *fb = alloc_fileBuffer(fp,0);
+  char *line;
+  long n, i;
+  int last=-1, width, short_line=0;
+
+  fb->offset = ftell(fp);
+  if (fb->offset<0) fb->offset=0;
+
+  while ( (line=next_line_fileBuffer(fb,&n)) ) {
+    width = n+1;
+    if ( n>0 && line[n-1]=='\r' ) --n;
+    if ( n>0 && line[0]=='>' ) {
+      for (i=1; i<n; ++i) if ( isspace(line[i]) ) break;
+      add_faiIndex(fai, line+1, i-1, tell_fileBuffer(fb));
+      last = fai->n-1;
+      short_line = 0;
+      continue;
+    }
+    if (last<0) {
+      if (n==0 || line[0]=='#') continue;
+      ERROR("build_faiIndex: Sequence before the first header line",1);
+    }
+    // A line shorter than the first is only allowed as the last line
+    if (n==0) { if (fai->len[last]>0) short_line=1; continue; }
+    if (fai->linebases[last]==0) {
+      fai->offset[last] = fb->offset + (line-fb->buf);
+      fai->linebases[last] = n;
+      fai->linewidth[last] = width;
+    }
+    else if ( short_line || n>fai->linebases[last] || (n==fai->linebases[last] && width!=fai->linewidth[last]) ) {
+      fprintf(stderr,"For sequence %s\n",fai->name[last]);
+      ERROR("build_faiIndex: Sequence lines have different lengths",1);
+    }
+    if (n<fai->linebases[last]) short_line=1;
+    fai->len[last] += n;
+  }
+
+  free_fileBuffer(fb);
+  hash_faiIndex(fai);
+
+  return fai;
+}
+
+
+// Write the index in .fai format
+void write_faiIndex(faiIndex *fai, FILE *fp) {
+  int i;
+  for (i=0; i<fai->n; ++i)
+    fprintf(fp,"%s\t%ld\t%ld\t%d\t%d\n",fai->name[i],fai->len[i],fai->offset[i],fai->linebases[i],fai->linewidth[i]);
+}
+
+
+// Read an index in .fai format
+faiIndex *read_faiIndex(FILE *fp) {
+  faiIndex *fai = alloc_faiIndex();
+  fileBuffer *fb = alloc_fileBuffer(fp,0);
+  char *line, *tab;
+  long n, len, offset;
+  int lb, lw;
+
+  while ( (line=next_line_fileBuffer(fb,&n)) ) {
+    if (n==0) continue;
+    tab = (char *)memchr(line,'\t',n);
+    if ( !tab || sscanf(tab+1,"%ld\t%ld\t%d\t%d",&len,&offset,&lb,&lw)!=4 )
+      ERROR("read_faiIndex: Wrong format of index file",1);
+    add_faiIndex(fai, line, tab-line, offset);
+    fai->len[fai->n-1] = len;
+    fai->linebases[fai->n-1] = lb;
+    fai->linewidth[fai->n-1] = lw;
+  }
+
+  free_fileBuffer(fb);
+  hash_faiIndex(fai);
+
+  return fai;
+}
+
+
+/*
+  Read the index from fastafile.fai. If it does not exist it is made from
+  the fasta file and written to fastafile.fai if write!=0.
+  Returns NULL if neither can be opened.
+*/
+faiIndex *load_faiIndex(char *fastafile, int write) {
+  char *ifile = (char *)malloc((strlen(fastafile)+5)*sizeof(char));
+  faiIndex *fai=NULL;
+  FILE *fp;
+
+  sprintf(ifile,"%s.fai",fastafile);
+  if ( (fp=fopen(ifile,"r")) ) {
+    fai = read_faiIndex(fp);
+    fclose(fp);
+  }
+  else if ( (fp=fopen(fastafile,"r")) ) {
+    fai = build_faiIndex(fp);
+    fclose(fp);
+    if ( write && (fp=fopen(ifile,"w")) ) {
+      write_faiIndex(fai,fp);
+      fclose(fp);
+    }
+  }
+  free(ifile);
+
+  return fai;
+}
+
+
+// Returns the number of the sequence with this name (-1 if not found)
+int lookup_faiIndex(faiIndex *fai, char *name) {
+  long i = (long)stringHash_lookup(name, fai->hash);
+  return (int)(i-1);
+}
+
+
+/*
+  Find the file positions of region [from,to[ of sequence i. to<0 or
+  to>len means the end of the sequence. Returns the number of residues
+*/
+static long region_faiIndex(faiIndex *fai, int i, long *from, long *to, long *start, long *end) {
+  long lb = fai->linebases[i], lw = fai->linewidth[i];
+
+  if (*from<0) *from = 0;
+  if (*to<0 || *to>fai->len[i]) *to = fai->len[i];
+  if (*from>=*to) return 0;
+
+  *start = fai->offset[i] + (*from/lb)*lw + *from%lb;
+  *end = fai->offset[i] + ((*to-1)/lb)*lw + (*to-1)%lb + 1;
+
+  return *to-*from;
+}
+
+
+/*
+  Make a Sequence of the bytes of a region (which includes line ends).
+  buf must be allocated and is used for the sequence.
+*/
+static Sequence *region_Sequence(faiIndex *fai, int i, char *buf, long nbytes, long nres, AlphabetStruct *alph) {
+  Sequence *seq = alloc_Sequence();
+  int cr = ( fai->linewidth[i]-fai->linebases[i] == 2 );
+  long k, l;
+
+  seq->id = strdup(fai->name[i]);
+  setBit(seq->flag,seq_flag_id);
+  // Only line ends are removed, since all other bytes are residues in the index
+  for (k=l=0; k<nbytes; ++k) if ( buf[k]!='\n' && !(cr && buf[k]=='\r') ) buf[l++] = buf[k];
+  seq->len = l;
+  if (seq->len!=nres) {
+    fprintf(stderr,"For sequence %s\n",fai->name[i]);
+    ERROR("fetch_faiIndex: Index does not match the fasta file",1);
+  }
+  buf[seq->len] = 0;
+  seq->s = buf;
+  setBit(seq->flag,seq_flag_seq);
+  if (alph) translate2numbers(seq->s, seq->len, alph);
+
+  return seq;
+}
+
+
+/*
+  Returns region [from,to[ of the named sequence read from fp (which must
+  be seekable) and translated with alph (if alph!=NULL). to<0 means the
+  end of the sequence.
+  Returns NULL if the name is not in the index or the region is empty.
+*/
+Sequence *fetch_faiIndex(faiIndex *fai, FILE *fp, char *name, long from, long to, AlphabetStruct *alph) {
+  long start, end, nres;
+  char *buf;
+  int i = lookup_faiIndex(fai, name);
+
+  if (i<0) return NULL;
+  if ( (nres=region_faiIndex(fai, i, &from, &to, &start, &end))==0 ) return NULL;
+
+  buf = (char *)malloc((end-start+1)*sizeof(char));
+  if ( fseek(fp, start, SEEK_SET)!=0 || (long)fread(buf, 1, end-start, fp)!=end-start )
+    ERROR("fetch_faiIndex: Could not read region from file",1);
+
+  return region_Sequence(fai, i, buf, end-start, nres, alph);
+}
+
+
+// As fetch_faiIndex, but the file is memory mapped with mmap_fileBuffer
+Sequence *fetch_faiIndex_mmap(faiIndex *fai, fileBuffer *fb, char *name, long from, long to, AlphabetStruct *alph) {
+  long start, end, nres;
+  char *buf;
+  int i = lookup_faiIndex(fai, name);
+
+  if (i<0) return NULL;
+  if ( (nres=region_faiIndex(fai, i, &from, &to, &start, &end))==0 ) return NULL;
+  if ( end>fb->len ) ERROR("fetch_faiIndex_mmap: Region outside the file",1);
+
+  buf = (char *)malloc((end-start+1)*sizeof(char));
+  memcpy(buf, fb->buf+start, end-start);
+
+  return region_Sequence(fai, i, buf, end-start, nres, alph);
+}
+
+
+
 /*
   You can specify the single line format with a string like this:
      'i1s5l6q7S '
@@ -821,6 +1909,10 @@ singleLineStruct *make_singleLineStruct(int separator, int id_field, int seq_fie
   r->strings = (iString**)malloc((r->max_field+1)*sizeof(iString*));
   for (i=0; i<=r->max_field; ++i) r->strings[i]=r->desc;
 
+  r->seq = NULL;
+  r->buf = NULL;
+  r->bufsize = 0;
+
   return r;
 }
 
@@ -828,6 +1920,8 @@ singleLineStruct *make_singleLineStruct(int separator, int id_field, int seq_fie
 void free_singleLineStruct(singleLineStruct *s) {
   free(s->strings);
   free_iString(s->desc);
+  if (s->seq) free(s->seq);
+  if (s->buf) free(s->buf);
   free(s);
 }
 
@@ -929,30 +2023,130 @@ Sequence *readSingleLineFormat(FILE *fp, singleLineStruct *sls, int read_size, c
 
 
 
-
-/* Complement a sequence using the trans table
+/*
+  As readSingleLineFormat, but reading from a fileBuffer without any
+  allocations per line. The fields are found in the line in the buffer
+  and copied (and translated) into a buffer in sls, which is reused for
+  the next line.
+
+  The Sequence returned belongs to sls and is only valid until the next
+  call. It must NOT be freed (copy what you need to keep).
+  Returns NULL on EOF.
 */
-static inline void complement(char *s, const char *trans, const int len) {
-  int i;
-  for (i=0; i<len; ++i) s[i] = trans[ (int)s[i] ];
+Sequence *readSingleLine_fileBuffer(fileBuffer *fb, singleLineStruct *sls) {
+  char *line, *end, *field, *sep, *d, *id=NULL, *s=NULL, *lab=NULL, *q=NULL;
+  long n, l, idlen=0, slen=0, lablen=0, qlen=0, desclen=0;
+  int i, error=0;
+  Sequence *seq;
+
+  // Blank lines are ignored
+  while ( (line=next_line_fileBuffer(fb,&n)) && n==0 );
+  if (!line) return NULL;
+
+  if (sls->bufsize < 2*n+8) {
+    sls->bufsize = 2*n+8;
+    sls->buf = (char *)realloc(sls->buf, sls->bufsize*sizeof(char));
+  }
+  if (!sls->seq) sls->seq = (Sequence *)malloc(sizeof(Sequence));
+  seq = sls->seq;
+  init_Sequence(seq);
+
+  // The description is collected at the end of buf (after room for the other fields)
+  d = sls->buf+n+4;
+  end = line+n;
+  for (i=0, field=line; field<=end; ++i, field=sep+1) {
+    sep = (char *)memchr(field, sls->separator, end-field);
+    if (!sep) sep = end;
+    l = sep-field;
+    if (i==sls->id_field) { id = field; idlen = l; }
+    else if (i==sls->seq_field) { s = field; slen = l; }
+    else if (i==sls->lab_field) { lab = field; lablen = l; }
+    else if (i==sls->q_field) { q = field; qlen = l; }
+    else {
+      if (desclen>0) d[desclen++] = sls->separator;
+      memcpy(d+desclen, field, l);
+      desclen += l;
+    }
+  }
+
+  // Checks;
+  if (i<sls->max_field) { error++; fprintf(stderr,"readSingleLineFormat: Not all fields present on line."); }
+  if (idlen == 0) { error++; fprintf(stderr,"readSingleLineFormat: ID empty."); }
+  if (slen == 0) { error++; fprintf(stderr,"readSingleLineFormat: No sequence read."); }
+  if (sls->lab_field>=0 && slen != lablen) {
+    error++; fprintf(stderr,"readSingleLineFormat: Label has length different from sequence.");
+  }
+  if (sls->q_field>=0 && slen != qlen) {
+    error++; fprintf(stderr,"readSingleLineFormat: Label has length different from sequence.");
+  }
+  if (error) ERROR(" Dying",1);
+
+  // Copy the fields to buf: id, seq, lab, q (and descr is already there)
+  d = sls->buf;
+  seq->id = d;
+  memcpy(d, id, idlen);
+  d[idlen] = '\0';
+  d += idlen+1;
+  if (desclen>0) {
+    seq->descr = sls->buf+n+4;
+    seq->descr[desclen] = '\0';
+  }
+
+  seq->len = slen;
+  seq->s = d;
+  memcpy(d, s, slen);
+  translate2numbers(seq->s, slen, sls->seq_alph);
+  d += slen;
+
+  if (lab && sls->lab_alph) {
+    seq->lab = d;
+    memcpy(d, lab, slen);
+    translate2numbers(seq->lab, slen, sls->lab_alph);
+    d += slen;
+  }
+  if (q && sls->q_alph) {
+    seq->q = d;
+    memcpy(d, q, slen);
+    translate2numbers(seq->q, slen, sls->q_alph);
+  }
+
+  return seq;
 }
 
 
 
+
+/*
+  Reverse s, lab and q (if present) and complement s if comp!=NULL.
+  It is done in one traversal from both ends in blocks, so s, lab and q
+  are handled together while the blocks are in cache.
+*/
+static void revcomp_traverse(Sequence *seq, const char *comp, int ncomp) {
+  const long blocksize=(1<<14);
+  long i, k, half = seq->len/2;
+
+  for (i=0; i<half; i+=k) {
+    k = MINIMUM(blocksize, half-i);
+    revcomp_ends(seq->s, seq->len, i, k, comp, ncomp);
+    if (seq->lab) revcomp_ends(seq->lab, seq->len, i, k, NULL, 0);
+    if (seq->q) revcomp_ends(seq->q, seq->len, i, k, NULL, 0);
+  }
+  if ( comp && seq->len%2 ) seq->s[half] = comp[(int)seq->s[half]];
+}
+
+
 /*
   Reverse sequence - do NOT complement
 */
 void reverseSequence(Sequence *seq) {
   toggleBit(seq->flag,seq_flag_rev);
-  reverseStringInplace(seq->s,seq->len);
-  if (seq->lab) reverseStringInplace(seq->lab,seq->len);
-  if (seq->q) reverseStringInplace(seq->q,seq->len);
+  revcomp_traverse(seq, NULL, 0);
 }
 
 
 void revcompSequence(Sequence *seq, AlphabetStruct *astruct) {
-  reverseSequence(seq);
-  complement(seq->s,astruct->compTrans,seq->len);
+  toggleBit(seq->flag,seq_flag_rev);
+  revcomp_traverse(seq, astruct->compTrans, astruct->len);
   toggleBit(seq->flag,seq_flag_comp);
 }
 
@@ -968,6 +2162,8 @@ static Sequence *revcomp(Sequence *s, AlphabetStruct *astruct, int inplace) {
   if (!inplace) { // Allocates a new sequence, but point to id and description
     r = (Sequence*)malloc(sizeof(Sequence));
     memcpy(r,s,sizeof(Sequence));
+    r->counts = NULL;
+    clearBit(r->flag,seq_flag_counts);
     r->s = (char*)malloc(r->len*sizeof(char));
     if (s->lab) r->lab = (char*)malloc(r->len*sizeof(char));
     if (s->q) r->q = (char*)malloc(r->len*sizeof(char));
@@ -976,8 +2172,7 @@ static Sequence *revcomp(Sequence *s, AlphabetStruct *astruct, int inplace) {
   toggleBit(r->flag,seq_flag_rev);
   toggleBit(r->flag,seq_flag_comp);
 
-  reverseString(s->s, r->s, s->len);
-  complement(r->s, astruct->compTrans, r->len);
+  revcomp_bytes(s->s, r->s, s->len, astruct->compTrans, astruct->len);
 
   if (s->lab) reverseString(s->lab, r->lab, s->len);
   if (s->q) reverseString(s->q, r->q, s->len);
@@ -987,35 +2182,142 @@ static Sequence *revcomp(Sequence *s, AlphabetStruct *astruct, int inplace) {
 
 
 
+/*************************************************
+
+Writing sequences
+
+The residues are translated back to letters in blocks with
+translate_copy_bytes and the line breaks are inserted by copying whole
+lines. The write functions write to a writeBuffer and the print functions
+write to a FILE through a small writeBuffer on the stack.
+
+Usage:
+  writeBuffer *wb = alloc_writeBuffer(stdout,0);
+  while ( (seq=readFastq_fileBuffer(fb,dna,qual,1)) ) {
+    writeFastq(wb,seq,dna->a,qual->a);
+    free_Sequence(seq);
+  }
+  free_writeBuffer(wb);
+
+*************************************************/
+
+#define WRITE_BLOCK 16384
+
+
+/*
+  Write len residues translated with alphabet in lines of length linelen
+  (one line if linelen<=0) ending with a newline
+*/
+static void write_residues(writeBuffer *wb, char *s, long len, char *alphabet, long linelen) {
+  char tmp[WRITE_BLOCK], *d;
+  int nalph = strlen(alphabet);
+  long n, k, i, l, col=0;
+
+  if (linelen<=0) linelen = MAXIMUM(len,1);
+
+  for (n=0; n<len; n+=k) {
+    k = MINIMUM(len-n, WRITE_BLOCK);
+    translate_copy_bytes(s+n, tmp, k, alphabet, nalph);
+    d = room_writeBuffer(wb, k+k/linelen+2);
+    for (i=0; i<k; i+=l) {
+      l = MINIMUM(k-i, linelen-col);
+      memcpy(d, tmp+i, l);
+      d += l;
+      col += l;
+      if ( col==linelen && n+i+l<len ) { *d++ = '\n'; col=0; }
+    }
+    wb->len = d-wb->buf;
+  }
+  putc_writeBuffer(wb,'\n');
+}
+
+
+// Write ">id descr" or "@id descr" line
+static void write_header(writeBuffer *wb, Sequence *seq, int c) {
+  putc_writeBuffer(wb,c);
+  if (seq->id != NULL) puts_writeBuffer(wb,seq->id);
+  if (seq->descr != NULL) { putc_writeBuffer(wb,' '); puts_writeBuffer(wb,seq->descr); }
+  putc_writeBuffer(wb,'\n');
+}
+
+
+// As printFasta
+void writeFasta(writeBuffer *wb, Sequence *seq, char *alphabet, int linelen) {
+  if (linelen<=0) linelen=70;
+  write_header(wb, seq, '>');
+  write_residues(wb, seq->s, seq->len, alphabet, linelen);
+}
+
+
+// As printSeqOneLine
+void writeSeqOneLine(writeBuffer *wb, Sequence *seq, char *alphabet) {
+  if (seq->id != NULL) { puts_writeBuffer(wb,seq->id); putc_writeBuffer(wb,' '); }
+  write_residues(wb, seq->s, seq->len, alphabet, 0);
+}
+
+
+// Write fastq entry with qualities translated with qual_alphabet
+void writeFastq(writeBuffer *wb, Sequence *seq, char *alphabet, char *qual_alphabet) {
+  if (!seq->q && seq->len>0) {
+    if (seq->id) fprintf(stderr,"For sequence %s\n",seq->id);
+    ERROR("writeFastq: Sequence has no quality scores",1);
+  }
+  write_header(wb, seq, '@');
+  write_residues(wb, seq->s, seq->len, alphabet, 0);
+  write_writeBuffer(wb, "+\n", 2);
+  write_residues(wb, seq->q, seq->len, qual_alphabet, 0);
+}
+
+
 // Translates s in interval [from,from+printlen[ using alphabet and prints
 void printSeqRaw(FILE *file, char *s, int seqlen, char *alphabet, int from, int printlen) {
+  char tmp[WRITE_BLOCK];
+  int k, nalph = strlen(alphabet);
   int stop=from+printlen;
   if (stop>seqlen) stop=seqlen;
-  while ( from<stop ) fputc(alphabet[(int)s[from++]],file);
+  for ( ; from<stop; from+=k) {
+    k = MINIMUM(stop-from, WRITE_BLOCK);
+    translate_copy_bytes(s+from, tmp, k, alphabet, nalph);
+    fwrite(tmp, 1, k, file);
+  }
 }
 
 // As above but backwards
 void printSeqRawReverse(FILE *file, char *s, int seqlen, char *alphabet, int from, int printlen) {
+  char tmp[WRITE_BLOCK];
+  int k, nalph = strlen(alphabet);
   int n = from+printlen;
   if (n>seqlen) n=seqlen;
-  while ( n-- > from ) fputc(alphabet[(int)s[n]],file);
+  for ( ; n>from; n-=k) {
+    k = MINIMUM(n-from, WRITE_BLOCK);
+    revcomp_bytes(s+n-k, tmp, k, NULL, 0);
+    translate_copy_bytes(tmp, tmp, k, alphabet, nalph);
+    fwrite(tmp, 1, k, file);
+  }
 }
 
 
+/*
+  The print functions use write_residues on a writeBuffer on the stack.
+  It has room for a block with a newline after each residue, which is
+  the most write_residues reserves.
+*/
+#define PRINT_BUFFER (2*WRITE_BLOCK+2)
+
 // Print id, space, sequence on one line
 void printSeqOneLine(FILE *file, Sequence *seq, char *alphabet) {
-  int n=0;
-  char *s = seq->s;
+  char buf[PRINT_BUFFER];
+  writeBuffer wb;
 
   if (seq->id != NULL) fprintf(file,"%s ",seq->id);
-
-  while (n<seq->len) fputc(alphabet[(int)s[n++]],file);
-  fputc('\n',file);
+  init_writeBuffer(&wb, file, buf, PRINT_BUFFER);
+  write_residues(&wb, seq->s, seq->len, alphabet, 0);
+  flush_writeBuffer(&wb);
 }
 
 void printFasta(FILE *file, Sequence *seq, char *alphabet, int linelen) {
-  int n=0;
-  char *s = seq->s;
+  char buf[PRINT_BUFFER];
+  writeBuffer wb;
 
   if (linelen<=0) linelen=70;
 
@@ -1023,11 +2325,9 @@ void printFasta(FILE *file, Sequence *seq, char *alphabet, int linelen) {
   if (seq->descr != NULL) fprintf(file," %s",seq->descr);
   fprintf(file,"\n");
 
-  while (n<seq->len) {
-    if (n>0 && n%linelen==0) fputc('\n',file);
-    fputc(alphabet[(int)s[n++]],file);
-  }
-  fputc('\n',file);
+  init_writeBuffer(&wb, file, buf, PRINT_BUFFER);
+  write_residues(&wb, seq->s, seq->len, alphabet, linelen);
+  flush_writeBuffer(&wb);
 }
 
 // Returns 64 if triplet contains unknown char
@@ -1038,19 +2338,6 @@ static inline int triplet2number(char *s) {
   return 16*(s[0]-1)+4*(s[1]-1)+(s[2]-1);
 }
 
-// Returns 64 if triplet contains unknown char
-// This is used for case-sensitive alphabets
-static inline int triplet2numberCaseSensitive(char *s) {
-  char x[3];
-  int i;
-  for (i=0;i<3;++i) {
-    x[i]=s[i];
-    if (x[i]>4) x[i]-=4;
-    if (x[i]<1 || x[i]>4) return 64;
-  }
-  return 16*(x[0]-1)+4*(x[1]-1)+(x[2]-1);
-}
-
 /*
   Make a hash with genetic code for a DNA alphabet
 
@@ -1147,6 +2434,37 @@ void makeGeneticCode(AlphabetStruct *alph, AlphabetStruct *prot_alph) {
 
 
 
+/*
+  Tables for translating codons with translate_codons
+
+  codes[x] is the code (0-3) of number x in the order of the genetic code
+  made by makeGeneticCode, and 16 if x is not one of the four bases
+  (for case sensitive alphabets lower case letters are also bases).
+  ccodes[x] is the code of the complement of x.
+*/
+void make_codonTables(codonTables *ct, AlphabetStruct *alph) {
+  int x, y;
+
+  if (alph->gCode==NULL) ERROR("You must call makeGeneticCode before translating",1);
+  ct->gcode = alph->gCode;
+  ct->ncodes = MINIMUM(alph->len,128);
+  for (x=0; x<ct->ncodes; ++x) {
+    y = x;
+    if ( y>4 && AlphabetStruct_test_flag(alph,AS_casesens) ) y -= 4;
+    ct->codes[x] = ( (y<1 || y>4) ? 16 : y-1 );
+  }
+  for (x=0; x<ct->ncodes; ++x) {
+    ct->ccodes[x] = 16;
+    if (ct->codes[x]>3) continue;
+    if (alph->compTrans) {
+      y = alph->compTrans[x];
+      if (y>=0 && y<ct->ncodes) ct->ccodes[x] = ct->codes[y];
+    }
+    else ct->ccodes[x] = 3-ct->codes[x];
+  }
+}
+
+
 /*
   Translate DNA to protein in all reading frames and returns as a string
   the same length as the original sequence
@@ -1165,26 +2483,16 @@ void makeGeneticCode(AlphabetStruct *alph, AlphabetStruct *prot_alph) {
 
  */
 char *translateDNA(Sequence *seq, AlphabetStruct *alph) {
-  int i, t;
   char *translation = (char *)malloc((seq->len+1)*sizeof(char));
+  codonTables ct;
 
   if (alph->gCode==NULL) ERROR("You must call makeGeneticCode before using translateDNA",1);
+  make_codonTables(&ct, alph);
 
-  translation[0] = translation[1] = alph->gCode[64];
-
-  if (AlphabetStruct_test_flag(alph,AS_casesens)) {
-    for (i=2; i<seq->len; ++i) {
-      t = triplet2numberCaseSensitive(seq->s+i-2);
-      translation[i] = alph->gCode[t];
-    }
-  }
-  else {
-    for (i=2; i<seq->len; ++i) {
-      t = triplet2number(seq->s+i-2);
-      translation[i] = alph->gCode[t];
-    }
-  }
-  translation[i] = '\0';
+  if (seq->len>0) translation[0] = alph->gCode[64];
+  if (seq->len>1) translation[1] = alph->gCode[64];
+  translate_codons(seq->s, 2, seq->len, ct.codes, ct.ccodes, ct.ncodes, ct.gcode, translation, NULL);
+  translation[seq->len] = '\0';
 
   return translation;
 }
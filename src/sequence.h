@@ -15,6 +15,7 @@ typedef struct __SEQstruct__ {
   char *s;         // Sequence
   char *q;         // Pointer to secondary sequence - e.g. qual scores (if any)
   char *lab;       // Pointer to labels (if any)
+  long *counts;    // Residue counts (if read with a seqStats with keep_counts set)
   int sort_order;
 
   struct __SEQstruct__ *next;  /* For a single linked list used when reading */
@@ -34,6 +35,86 @@ typedef struct {
 } AlphabetStruct;
 
 
+/* Composition statistics: counts[c] is the number of residues with number
+   c. lenhist[b] is the number of sequences of length l with 2^(b-1)<=l<2^b
+   (b=0 for length 0). seqlen and seqcounts are for the last sequence.
+   If keep_counts is set, the readers also give each sequence its own
+   counts in seq->counts (ncounts longs) */
+#define SEQSTATS_MAXALPH 128
+#define SEQSTATS_LENBINS 64
+typedef struct {
+  int ncounts;       // Alphabet length
+  int keep_counts;
+  long nseq;
+  long total;        // Number of residues
+  long minlen;
+  long maxlen;
+  long counts[SEQSTATS_MAXALPH];
+  long lenhist[SEQSTATS_LENBINS];
+  long seqlen;
+  long seqcounts[SEQSTATS_MAXALPH];
+} seqStats;
+
+
+/* A batch of sequences read together. The Sequences are in one array and
+   all their ids, descriptions, residues and qualities are in one arena.
+   If stats is set, the sequences are counted in it while read (and with
+   stats->keep_counts the counts of each sequence are kept in counts).
+   If lazy_id is set, the header lines are stored as they are, and the id
+   and descr of a sequence are only set by id_seqBatch or descr_seqBatch */
+typedef struct {
+  int n;             // Number of sequences
+  int nalloc;        // Allocated length of seq
+  Sequence *seq;     // Array of sequences
+  long *offsets;     // Offsets of id, descr, s and q in arena (header and its length if lazy_id)
+  int lazy_id;
+  long used;         // Bytes used in arena
+  long size;         // Allocated size of arena
+  char *arena;
+  seqStats *stats;
+  long *counts;      // Residue counts of the sequences (seq[i].counts points here)
+  long countsize;    // Allocated length of counts
+} seqBatch;
+
+
+/* A reader of one fasta or fastq stream with all its state, so readers
+   of different streams can be used from different threads */
+typedef struct {
+  fileBuffer *fb;
+  int type;          // '>' for fasta or '@' for fastq
+  AlphabetStruct *seq_alph;
+  AlphabetStruct *qual_alph;
+  int save_descr;
+  int eof;
+  long nread;        // Number of sequences read
+  seqStats *stats;   // If set, sequences are counted here
+  char include[256]; // Letters included in sequences
+} seqReader;
+
+
+/* Index of a fasta file (as the .fai files of samtools).
+   hash gives the number of a sequence plus one from its name */
+typedef struct {
+  int n;             // Number of sequences
+  int nalloc;
+  char **name;
+  long *len;         // Length of sequence
+  long *offset;      // File position of first residue
+  int *linebases;    // Residues per line
+  int *linewidth;    // Bytes per line (including line end)
+  simpleHash *hash;
+} faiIndex;
+
+
+// Tables for translating codons (see make_codonTables)
+typedef struct {
+  int ncodes;
+  char codes[128];
+  char ccodes[128];
+  char *gcode;
+} codonTables;
+
+
 // Structure containing stuff for reading the single line format
 typedef struct {
   int separator;
@@ -47,6 +128,9 @@ typedef struct {
   AlphabetStruct *lab_alph;
   iString *desc;
   iString **strings;
+  Sequence *seq;     // Sequence returned by readSingleLine_fileBuffer
+  char *buf;         // Buffer for its fields (reused for each line)
+  long bufsize;
 } singleLineStruct;
 
 
@@ -54,12 +138,13 @@ typedef struct {
 static const uchar seq_flag_rev=1;
 static const uchar seq_flag_comp=2;
 
-// Flags to track if id, descr, seq and lab are allocated (and should be freed)
+// Flags to track if id, descr, seq, lab, q and counts are allocated (and should be freed)
 static const uchar seq_flag_id=3;
 static const uchar seq_flag_descr=4;
 static const uchar seq_flag_seq=5;
 static const uchar seq_flag_lab=6;
 static const uchar seq_flag_q=7;
+static const uchar seq_flag_counts=8;
 
 // Alphabet flags
 #define AS_wildcard 1
@@ -97,6 +182,7 @@ static inline long reverse_coordinate_base1(long len, long i, long mlen) {
 /* FUNCTION PROTOTYPES BEGIN  ( by funcprototypes.pl ) */
 Sequence *alloc_Sequence();
 void free_Sequence(Sequence *ss);
+void free_Sequence_list(Sequence *seq);
 void case_sensitive_alphabet(AlphabetStruct *astruct);
 void case_insensitive_alphabet(AlphabetStruct *astruct);
 AlphabetStruct *alloc_AlphabetStruct(char *a, int caseSens, int revcomp, char term, int wildcard);
@@ -106,22 +192,57 @@ AlphabetStruct *bio_AlphabetStruct(char *a);
 void free_AlphabetStruct(AlphabetStruct *astruct);
 void print_AlphabetStruct(AlphabetStruct *a, FILE *fp);
 void translate2numbers(char *s, const long slen, AlphabetStruct *astruct);
+void init_seqStats(seqStats *st, AlphabetStruct *alph);
+void count_seqStats(seqStats *st, char *s, long len);
+void translate_seqStats(seqStats *st, char *s, long len, AlphabetStruct *alph);
+void keep_seqStats(seqStats *st, Sequence *seq);
+void merge_seqStats(seqStats *to, seqStats *from);
+double gc_seqStats(long *counts, AlphabetStruct *alph);
 Sequence *make_Sequence(char *letters, char *id, AlphabetStruct *alphabet);
 int ReadSequenceFileHeader(FILE *fp, int type);
 Sequence *readFasta(FILE *fp, AlphabetStruct *alph, int read_size, int save_descr, char *eof);
 Sequence *readFastq(FILE *fp, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int read_size, int save_descr, char *eof);
+int ReadSequenceFileHeader_fileBuffer(fileBuffer *fb, int type);
+Sequence *readFasta_fileBuffer(fileBuffer *fb, AlphabetStruct *alph, int save_descr);
+Sequence *readFastq_fileBuffer(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr);
+Sequence *readFastaStats_fileBuffer(fileBuffer *fb, AlphabetStruct *alph, int save_descr, seqStats *st);
+Sequence *readFastqStats_fileBuffer(fileBuffer *fb, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr,
+				    seqStats *st);
+Sequence *readFasta_inplace(fileBuffer *fb, AlphabetStruct *alph, int save_descr);
+seqBatch *alloc_seqBatch();
+void free_seqBatch(seqBatch *b);
+seqReader *alloc_seqReader(fileBuffer *fb, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph, int save_descr);
+Sequence *read_seqReader(seqReader *r);
+void free_seqReader(seqReader *r);
+char *id_seqBatch(seqBatch *b, int i);
+char *descr_seqBatch(seqBatch *b, int i);
+int read_seqBatch(seqBatch *b, fileBuffer *fb, int type, AlphabetStruct *seq_alph, AlphabetStruct *qual_alph,
+		  int save_descr, int maxseq, long maxbytes);
+void free_faiIndex(faiIndex *fai);
+faiIndex *build_faiIndex(FILE *fp);
+void write_faiIndex(faiIndex *fai, FILE *fp);
+faiIndex *read_faiIndex(FILE *fp);
+faiIndex *load_faiIndex(char *fastafile, int write);
+int lookup_faiIndex(faiIndex *fai, char *name);
+Sequence *fetch_faiIndex(faiIndex *fai, FILE *fp, char *name, long from, long to, AlphabetStruct *alph);
+Sequence *fetch_faiIndex_mmap(faiIndex *fai, fileBuffer *fb, char *name, long from, long to, AlphabetStruct *alph);
 singleLineStruct *make_singleLineStruct(int separator, int id_field, int seq_field, int lab_field, int q_field,
 					AlphabetStruct *seq_alph, AlphabetStruct *lab_alph, AlphabetStruct *q_alph,
 					char *format);
 void free_singleLineStruct(singleLineStruct *s);
 Sequence *readSingleLineFormat(FILE *fp, singleLineStruct *sls, int read_size, char *eof);
+Sequence *readSingleLine_fileBuffer(fileBuffer *fb, singleLineStruct *sls);
 void reverseSequence(Sequence *seq);
 void revcompSequence(Sequence *seq, AlphabetStruct *astruct);
+void writeFasta(writeBuffer *wb, Sequence *seq, char *alphabet, int linelen);
+void writeSeqOneLine(writeBuffer *wb, Sequence *seq, char *alphabet);
+void writeFastq(writeBuffer *wb, Sequence *seq, char *alphabet, char *qual_alphabet);
 void printSeqRaw(FILE *file, char *s, int seqlen, char *alphabet, int from, int printlen);
 void printSeqRawReverse(FILE *file, char *s, int seqlen, char *alphabet, int from, int printlen);
 void printSeqOneLine(FILE *file, Sequence *seq, char *alphabet);
 void printFasta(FILE *file, Sequence *seq, char *alphabet, int linelen);
 void makeGeneticCode(AlphabetStruct *alph, AlphabetStruct *prot_alph);
+void make_codonTables(codonTables *ct, AlphabetStruct *alph);
 char *translateDNA(Sequence *seq, AlphabetStruct *alph);
 /* FUNCTION PROTOTYPES END */
 
@@ -0,0 +1,623 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simdKernels.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(NOSIMD)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+
+/*
+  Returns 2 if AVX2 kernels are used, 0 if plain C
+*/
+int simd_level() {
+#ifdef SIMD_X86
+  if ( __builtin_cpu_supports("avx2") ) return 2;
+#endif
+  return 0;
+}
+
+
+/*************************************************
+
+Translation with a table of 128 entries: s[i] = table[s[i]]
+
+This is what translate2numbers does with the trans table of an
+alphabet. The vector version looks up 16 entries at a time with a byte
+shuffle indexed by the low 4 bits, and picks the row of the table from
+the high 4 bits. Letters are all in rows 4-7, so if all bytes in a
+block are >=64 only these four rows are used.
+
+Bytes >=128 are not in the table; blocks with such bytes are done by
+the plain version to give the same result as before.
+
+*************************************************/
+
+static void translate_bytes_plain(char *s, long n, const char *table) {
+  long k;
+  for (k=0; k<n; ++k) s[k] = table[(int)s[k]];
+}
+
+
+#ifdef SIMD_X86
+__attribute__((target("avx2")))
+static void set_rows_avx2(__m256i *row, const char *table) {
+  int h;
+  for (h=0; h<8; ++h) row[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(table+16*h)));
+}
+
+
+// Translate 32 bytes (all <128) with the table in row
+__attribute__((target("avx2")))
+static inline __m256i translate32_avx2(__m256i x, __m256i *row) {
+  const __m256i low4 = _mm256_set1_epi8(0x0f);
+  const __m256i max_nonletter = _mm256_set1_epi8(0x3f);
+  __m256i lo, hi, r, m;
+  int h;
+
+  lo = _mm256_and_si256(x, low4);
+  hi = _mm256_and_si256(_mm256_srli_epi16(x,4), low4);
+  r = _mm256_setzero_si256();
+  h = ( _mm256_movemask_epi8(_mm256_cmpgt_epi8(x,max_nonletter)) == -1 ) ? 4 : 0;
+  for ( ; h<8; ++h) {
+    m = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(h));
+    r = _mm256_or_si256(r, _mm256_and_si256(m, _mm256_shuffle_epi8(row[h],lo)));
+  }
+  return r;
+}
+
+
+__attribute__((target("avx2")))
+static void translate_bytes_avx2(char *s, long n, const char *table) {
+  __m256i row[8], x;
+  long k;
+
+  set_rows_avx2(row, table);
+
+  for (k=0; k+32<=n; k+=32) {
+    x = _mm256_loadu_si256((const __m256i *)(s+k));
+    if ( _mm256_movemask_epi8(x) ) { translate_bytes_plain(s+k, 32, table); continue; }
+    _mm256_storeu_si256((__m256i *)(s+k), translate32_avx2(x,row));
+  }
+
+  translate_bytes_plain(s+k, n-k, table);
+}
+#endif
+
+
+void translate_bytes(char *s, long n, const char *table) {
+#ifdef SIMD_X86
+  if ( n>=32 && __builtin_cpu_supports("avx2") ) { translate_bytes_avx2(s, n, table); return; }
+#endif
+  translate_bytes_plain(s, n, table);
+}
+
+
+
+/*************************************************
+
+Translation and counting in one pass
+
+translate_count_bytes translates as translate_bytes (if table!=NULL)
+and adds the number of bytes with each value c<ncounts to counts[c].
+The vector version counts 32 bytes at a time in byte counters (one per
+value) with compares, and adds them up every 255 blocks. This is done
+for ncounts<=32; for larger alphabets only the translation is vectorized.
+
+*************************************************/
+
+static void count_bytes_plain(const char *s, long n, long *counts, int ncounts) {
+  long k;
+  int c;
+  for (k=0; k<n; ++k) {
+    c = (unsigned char)s[k];
+    if (c<ncounts) counts[c] += 1;
+  }
+}
+
+
+#ifdef SIMD_X86
+__attribute__((target("avx2")))
+static void add_counters_avx2(__m256i *acc, long *counts, int ncounts) {
+  __m256i x;
+  int c;
+  for (c=0; c<ncounts; ++c) {
+    x = _mm256_sad_epu8(acc[c], _mm256_setzero_si256());
+    counts[c] += _mm256_extract_epi64(x,0) + _mm256_extract_epi64(x,1) + _mm256_extract_epi64(x,2) + _mm256_extract_epi64(x,3);
+    acc[c] = _mm256_setzero_si256();
+  }
+}
+
+
+__attribute__((target("avx2")))
+static void translate_count_bytes_avx2(char *s, long n, const char *table, long *counts, int ncounts) {
+  __m256i row[8], acc[32], x;
+  long k;
+  int c, blocks=0, vcount=(ncounts<=32);
+
+  if (table) set_rows_avx2(row, table);
+  if (vcount) for (c=0; c<ncounts; ++c) acc[c] = _mm256_setzero_si256();
+
+  for (k=0; k+32<=n; k+=32) {
+    x = _mm256_loadu_si256((const __m256i *)(s+k));
+    if (table) {
+      if ( _mm256_movemask_epi8(x) ) {
+	translate_bytes_plain(s+k, 32, table);
+	x = _mm256_loadu_si256((const __m256i *)(s+k));
+      }
+      else {
+	x = translate32_avx2(x,row);
+	_mm256_storeu_si256((__m256i *)(s+k), x);
+      }
+    }
+    if (!vcount) { count_bytes_plain(s+k, 32, counts, ncounts); continue; }
+    // cmpeq gives -1 for equal bytes
+    for (c=0; c<ncounts; ++c) acc[c] = _mm256_sub_epi8(acc[c], _mm256_cmpeq_epi8(x,_mm256_set1_epi8(c)));
+    if (++blocks==255) { add_counters_avx2(acc, counts, ncounts); blocks=0; }
+  }
+  if (vcount) add_counters_avx2(acc, counts, ncounts);
+
+  if (table) translate_bytes_plain(s+k, n-k, table);
+  count_bytes_plain(s+k, n-k, counts, ncounts);
+}
+#endif
+
+
+void translate_count_bytes(char *s, long n, const char *table, long *counts, int ncounts) {
+#ifdef SIMD_X86
+  if ( n>=32 && __builtin_cpu_supports("avx2") ) { translate_count_bytes_avx2(s, n, table, counts, ncounts); return; }
+#endif
+  if (table) translate_bytes_plain(s, n, table);
+  count_bytes_plain(s, n, counts, ncounts);
+}
+
+
+
+/*************************************************
+
+Reverse complement in one pass
+
+The complement is a table comp of length ncomp (the compTrans of an
+alphabet), and a sequence is complemented by s[i] = comp[s[i]].
+If comp==NULL the sequence is only reversed.
+
+revcomp_ends does the positions [from,from+k[ and their mirror positions
+n-1-from-k+1 .. n-1-from, so a long sequence can be done in blocks from
+both ends, which is used to reverse seq, labels and qualities in the same
+traversal. Note that from+k<=n/2 and that the middle position of a
+sequence of uneven length has to be complemented separately.
+
+The vector version reverses 32 bytes with a shuffle and a lane swap and
+complements with a shuffle lookup in the table (if ncomp<=32). Blocks
+with numbers outside the table are done by the plain version.
+
+*************************************************/
+
+
+static void revcomp_ends_plain(char *s, long n, long from, long k, const char *comp) {
+  long i, j;
+  char a;
+  for (i=from, j=n-1-from; i<from+k; ++i, --j) {
+    a = s[i];
+    if (comp) { s[i] = comp[(int)s[j]]; s[j] = comp[(int)a]; }
+    else { s[i] = s[j]; s[j] = a; }
+  }
+}
+
+
+static void revcomp_bytes_plain(char *s, char *r, long n, const char *comp) {
+  long i;
+  if (comp) for (i=0; i<n; ++i) r[i] = comp[(int)s[n-1-i]];
+  else for (i=0; i<n; ++i) r[i] = s[n-1-i];
+}
+
+
+#ifdef SIMD_X86
+
+// Table of up to 32 entries for lookup with byte shuffles
+typedef struct {
+  __m256i t0, t1;    // Table entries 0-15 and 16-31 in both lanes
+  __m256i last;      // ntable-1
+} lookupTable_avx2;
+
+
+__attribute__((target("avx2")))
+static void set_lookupTable_avx2(lookupTable_avx2 *ct, const char *table, int ntable) {
+  char tab[32];
+  memset(tab, 0, 32);
+  memcpy(tab, table, ntable);
+  ct->t0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tab));
+  ct->t1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(tab+16)));
+  ct->last = _mm256_set1_epi8(ntable-1);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i reverse32_avx2(__m256i x) {
+  const __m256i rev = _mm256_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,
+				       15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+  return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(x,rev), 0x4E);
+}
+
+
+// Look up x in the table, returns 0 if some numbers are not in the table
+__attribute__((target("avx2")))
+static inline int lookup32_avx2(__m256i *x, lookupTable_avx2 *ct) {
+  __m256i r0, r1;
+  if ( _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(*x,ct->last),ct->last)) != -1 ) return 0;
+  r0 = _mm256_shuffle_epi8(ct->t0, *x);
+  r1 = _mm256_shuffle_epi8(ct->t1, *x);
+  *x = _mm256_blendv_epi8(r0, r1, _mm256_cmpgt_epi8(*x,_mm256_set1_epi8(15)));
+  return 1;
+}
+
+
+__attribute__((target("avx2")))
+static void revcomp_ends_avx2(char *s, long n, long from, long k, const char *comp, int ncomp) {
+  lookupTable_avx2 ct;
+  __m256i lo, hi;
+  long j;
+
+  if (comp) set_lookupTable_avx2(&ct, comp, ncomp);
+
+  for (j=from; j+32<=from+k; j+=32) {
+    lo = _mm256_loadu_si256((const __m256i *)(s+j));
+    hi = _mm256_loadu_si256((const __m256i *)(s+n-j-32));
+    if ( comp && !(lookup32_avx2(&lo,&ct) && lookup32_avx2(&hi,&ct)) ) {
+      revcomp_ends_plain(s, n, j, 32, comp);
+      continue;
+    }
+    _mm256_storeu_si256((__m256i *)(s+j), reverse32_avx2(hi));
+    _mm256_storeu_si256((__m256i *)(s+n-j-32), reverse32_avx2(lo));
+  }
+  revcomp_ends_plain(s, n, j, from+k-j, comp);
+}
+
+
+__attribute__((target("avx2")))
+static void revcomp_bytes_avx2(char *s, char *r, long n, const char *comp, int ncomp) {
+  lookupTable_avx2 ct;
+  __m256i x;
+  long j;
+
+  if (comp) set_lookupTable_avx2(&ct, comp, ncomp);
+
+  for (j=0; j+32<=n; j+=32) {
+    x = _mm256_loadu_si256((const __m256i *)(s+n-j-32));
+    if ( comp && !lookup32_avx2(&x,&ct) ) {
+      revcomp_bytes_plain(s+n-j-32, r+j, 32, comp);
+      continue;
+    }
+    _mm256_storeu_si256((__m256i *)(r+j), reverse32_avx2(x));
+  }
+  revcomp_bytes_plain(s, r+j, n-j, comp);
+}
+
+#endif
+
+
+/*
+  Reverse (complement) positions [from,from+k[ with the mirror positions
+  from the end in place. Requires from+k<=n/2
+*/
+void revcomp_ends(char *s, long n, long from, long k, const char *comp, int ncomp) {
+#ifdef SIMD_X86
+  if ( k>=32 && ncomp<=32 && __builtin_cpu_supports("avx2") ) {
+    revcomp_ends_avx2(s, n, from, k, comp, ncomp);
+    return;
+  }
+#endif
+  revcomp_ends_plain(s, n, from, k, comp);
+}
+
+
+/*
+  Reverse (complement) s into r (both of length n). s and r can be the same
+*/
+void revcomp_bytes(char *s, char *r, long n, const char *comp, int ncomp) {
+  if (s==r) {
+    revcomp_ends(s, n, 0, n/2, comp, ncomp);
+    if ( comp && n%2 ) s[n/2] = comp[(int)s[n/2]];
+    return;
+  }
+#ifdef SIMD_X86
+  if ( n>=32 && ncomp<=32 && __builtin_cpu_supports("avx2") ) {
+    revcomp_bytes_avx2(s, r, n, comp, ncomp);
+    return;
+  }
+#endif
+  revcomp_bytes_plain(s, r, n, comp);
+}
+
+
+
+/*************************************************
+
+Translation from numbers back to letters: d[i] = table[s[i]]
+
+table is the alphabet string of an AlphabetStruct (a) of length ntable.
+The vector version looks up 32 numbers at a time with byte shuffles if
+ntable<=32. For larger alphabets where letters 1..ntable-1 are
+consecutive chars (like quality scores) a constant is added instead, and
+other tables of up to 64 entries (like quality bins) are looked up in two
+halves. Blocks with numbers outside the table are done by the plain
+version.
+
+*************************************************/
+
+static void translate_copy_bytes_plain(const char *s, char *d, long n, const char *table) {
+  long i;
+  for (i=0; i<n; ++i) d[i] = table[(int)s[i]];
+}
+
+
+#ifdef SIMD_X86
+
+__attribute__((target("avx2")))
+static void translate_copy_bytes_avx2(const char *s, char *d, long n, const char *table, int ntable) {
+  lookupTable_avx2 ct, ct2;
+  __m256i x, y, add, first, last;
+  int i, consecutive=0, two=0;
+  long j;
+
+  memset(&ct2, 0, sizeof(lookupTable_avx2));
+  if (ntable<=32) set_lookupTable_avx2(&ct, table, ntable);
+  else {
+    for (i=2; i<ntable; ++i) if ( table[i]!=table[1]+i-1 ) break;
+    if (i==ntable && ntable<=127) consecutive = 1;
+    else if (ntable<=64) {
+      set_lookupTable_avx2(&ct, table, 32);
+      set_lookupTable_avx2(&ct2, table+32, ntable-32);
+      two = 1;
+    }
+    else { translate_copy_bytes_plain(s, d, n, table); return; }
+  }
+  add = _mm256_set1_epi8(table[1]-1);
+  first = _mm256_set1_epi8(1);
+  last = _mm256_set1_epi8(ntable-1);
+
+  for (j=0; j+32<=n; j+=32) {
+    x = _mm256_loadu_si256((const __m256i *)(s+j));
+    if (consecutive) {
+      // All must be in [1,ntable-1]
+      if ( _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(first,x),_mm256_cmpgt_epi8(x,last))) ) {
+	translate_copy_bytes_plain(s+j, d+j, 32, table);
+	continue;
+      }
+      x = _mm256_add_epi8(x, add);
+    }
+    else if (two) {
+      // Numbers 32-63 are looked up in the second table
+      if ( _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(x,last),last)) != -1 ) {
+	translate_copy_bytes_plain(s+j, d+j, 32, table);
+	continue;
+      }
+      y = _mm256_sub_epi8(x, _mm256_set1_epi8(32));
+      y = _mm256_blendv_epi8(_mm256_shuffle_epi8(ct2.t0,y), _mm256_shuffle_epi8(ct2.t1,y), _mm256_cmpgt_epi8(y,_mm256_set1_epi8(15)));
+      x = _mm256_blendv_epi8(_mm256_blendv_epi8(_mm256_shuffle_epi8(ct.t0,x), _mm256_shuffle_epi8(ct.t1,x),
+						_mm256_cmpgt_epi8(x,_mm256_set1_epi8(15))),
+			     y, _mm256_cmpgt_epi8(x,_mm256_set1_epi8(31)));
+    }
+    else if ( !lookup32_avx2(&x,&ct) ) {
+      translate_copy_bytes_plain(s+j, d+j, 32, table);
+      continue;
+    }
+    _mm256_storeu_si256((__m256i *)(d+j), x);
+  }
+  translate_copy_bytes_plain(s+j, d+j, n-j, table);
+}
+
+#endif
+
+
+void translate_copy_bytes(const char *s, char *d, long n, const char *table, int ntable) {
+#ifdef SIMD_X86
+  if ( n>=32 && ntable>0 && __builtin_cpu_supports("avx2") ) {
+    translate_copy_bytes_avx2(s, d, n, table, ntable);
+    return;
+  }
+#endif
+  translate_copy_bytes_plain(s, d, n, table);
+}
+
+
+
+/*************************************************
+
+Translation of codons (see translation.c)
+
+For each position i in [from,to[ the codon s[i-2..i] is translated:
+  fwd[i]   = gcode[codon]
+  rev[i-2] = gcode[reverse complement codon]
+so from>=2. codes[x] is 0-3 for the four bases and 16 for other numbers
+x<ncodes, and ccodes[x] is the code of the complement (also 16 if not a
+base). gcode has 65 entries where entry 64 is used for codons with other
+numbers. The codon number is 16*c0+4*c1+c2 for codes c0,c1,c2.
+If rev==NULL only fwd is done.
+
+The plain version rolls the codon numbers along the sequence. The vector
+version finds the codes of 32 positions at a time by shuffle lookups
+(if ncodes<=32) and looks up the codons in the 64 entries of gcode with
+four shuffles.
+
+*************************************************/
+
+static void translate_codons_plain(const char *s, long from, long to, const char *codes, const char *ccodes,
+				   int ncodes, const char *gcode, char *fwd, char *rev) {
+  long i, lastbad=from-3;
+  int c, cc, x, idx=0, ridx=0;
+
+  for (i=from-2; i<to; ++i) {
+    x = (unsigned char)s[i];
+    if (x<ncodes) { c = codes[x]; cc = ccodes[x]; }
+    else c = cc = 16;
+    if (c>3 || cc>3) lastbad = i;
+    idx = ( (idx<<2) | (c&3) ) & 63;
+    ridx = (ridx>>2) | ((cc&3)<<4);
+    if (i<from) continue;
+    if (i-lastbad<3) {
+      fwd[i] = gcode[64];
+      if (rev) rev[i-2] = gcode[64];
+    }
+    else {
+      fwd[i] = gcode[idx];
+      if (rev) rev[i-2] = gcode[ridx];
+    }
+  }
+}
+
+
+#ifdef SIMD_X86
+
+// Look up the codon numbers x (0-63) in the four parts of the genetic code
+__attribute__((target("avx2")))
+static inline __m256i gcode_lookup_avx2(__m256i x, __m256i *g) {
+  const __m256i low4 = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(x, low4);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x,4), low4);
+  __m256i r = _mm256_shuffle_epi8(g[0], lo);
+  int h;
+  for (h=1; h<4; ++h)
+    r = _mm256_blendv_epi8(r, _mm256_shuffle_epi8(g[h],lo), _mm256_cmpeq_epi8(hi,_mm256_set1_epi8(h)));
+  return r;
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i codon_avx2(__m256i c0, __m256i c1, __m256i c2) {
+  const __m256i three = _mm256_set1_epi8(3);
+  c0 = _mm256_slli_epi16(_mm256_and_si256(c0,three), 4);
+  c1 = _mm256_slli_epi16(_mm256_and_si256(c1,three), 2);
+  return _mm256_or_si256(_mm256_or_si256(c0,c1), _mm256_and_si256(c2,three));
+}
+
+
+__attribute__((target("avx2")))
+static void translate_codons_avx2(const char *s, long from, long to, const char *codes, const char *ccodes,
+				  int ncodes, const char *gcode, char *fwd, char *rev) {
+  lookupTable_avx2 ct, cct;
+  __m256i g[4], x0, x1, x2, c0, c1, c2, bad, X, r;
+  const __m256i badbit = _mm256_set1_epi8(16);
+  long i;
+  int h;
+
+  set_lookupTable_avx2(&ct, codes, ncodes);
+  set_lookupTable_avx2(&cct, ccodes, ncodes);
+  for (h=0; h<4; ++h) g[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(gcode+16*h)));
+  X = _mm256_set1_epi8(gcode[64]);
+
+  for (i=from; i+32<=to; i+=32) {
+    x0 = c0 = _mm256_loadu_si256((const __m256i *)(s+i-2));
+    x1 = c1 = _mm256_loadu_si256((const __m256i *)(s+i-1));
+    x2 = c2 = _mm256_loadu_si256((const __m256i *)(s+i));
+    if ( !(lookup32_avx2(&c0,&ct) && lookup32_avx2(&c1,&ct) && lookup32_avx2(&c2,&ct)) ) {
+      translate_codons_plain(s, i, i+32, codes, ccodes, ncodes, gcode, fwd, rev);
+      continue;
+    }
+    bad = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_or_si256(_mm256_or_si256(c0,c1),c2),badbit), badbit);
+    r = gcode_lookup_avx2(codon_avx2(c0,c1,c2), g);
+    _mm256_storeu_si256((__m256i *)(fwd+i), _mm256_blendv_epi8(r,X,bad));
+    if (rev) {
+      lookup32_avx2(&x0,&cct);
+      lookup32_avx2(&x1,&cct);
+      lookup32_avx2(&x2,&cct);
+      bad = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_or_si256(_mm256_or_si256(x0,x1),x2),badbit), badbit);
+      r = gcode_lookup_avx2(codon_avx2(x2,x1,x0), g);
+      _mm256_storeu_si256((__m256i *)(rev+i-2), _mm256_blendv_epi8(r,X,bad));
+    }
+  }
+  if (i<to) translate_codons_plain(s, i, to, codes, ccodes, ncodes, gcode, fwd, rev);
+}
+
+#endif
+
+
+void translate_codons(const char *s, long from, long to, const char *codes, const char *ccodes,
+		      int ncodes, const char *gcode, char *fwd, char *rev) {
+  if (from<2) from=2;
+  if (from>=to) return;
+#ifdef SIMD_X86
+  if ( to-from>=32 && ncodes<=32 && __builtin_cpu_supports("avx2") ) {
+    translate_codons_avx2(s, from, to, codes, ccodes, ncodes, gcode, fwd, rev);
+    return;
+  }
+#endif
+  translate_codons_plain(s, from, to, codes, ccodes, ncodes, gcode, fwd, rev);
+}
+
+
+
+/*************************************************
+
+Quality statistics
+
+For n quality scores q (numbers 0-127) and the residues s, find the sum
+and the minimum of q, and the number of residues in s equal to c. s can
+be NULL. The vector version sums with _mm256_sad_epu8.
+
+*************************************************/
+
+static void quality_stats_plain(const char *q, const char *s, long n, int c, long *sum, int *min, long *count) {
+  long i;
+  for (i=0; i<n; ++i) {
+    *sum += q[i];
+    if (q[i] < *min) *min = q[i];
+  }
+  if (s) for (i=0; i<n; ++i) *count += (s[i]==c);
+}
+
+
+#ifdef SIMD_X86
+
+__attribute__((target("avx2")))
+static void quality_stats_avx2(const char *q, const char *s, long n, int c, long *sum, int *min, long *count) {
+  __m256i x, acc = _mm256_setzero_si256(), mn = _mm256_set1_epi8(127);
+  const __m256i zero = _mm256_setzero_si256(), cc = _mm256_set1_epi8(c);
+  char m[32];
+  long j, cnt=0;
+  int k;
+
+  for (j=0; j+32<=n; j+=32) {
+    x = _mm256_loadu_si256((const __m256i *)(q+j));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(x,zero));
+    mn = _mm256_min_epi8(mn, x);
+    if (s) {
+      x = _mm256_loadu_si256((const __m256i *)(s+j));
+      cnt += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x,cc)));
+    }
+  }
+  *sum += _mm256_extract_epi64(acc,0) + _mm256_extract_epi64(acc,1) + _mm256_extract_epi64(acc,2) + _mm256_extract_epi64(acc,3);
+  _mm256_storeu_si256((__m256i *)m, mn);
+  for (k=0; k<32; ++k) if (m[k] < *min) *min = m[k];
+  *count += cnt;
+
+  quality_stats_plain(q+j, (s?s+j:NULL), n-j, c, sum, min, count);
+}
+
+#endif
+
+
+/*
+  Sets *sum, *min and *count (*min is 127 if n==0)
+*/
+void quality_stats(const char *q, const char *s, long n, int c, long *sum, int *min, long *count) {
+  *sum = 0;
+  *min = 127;
+  *count = 0;
+#ifdef SIMD_X86
+  if ( n>=32 && __builtin_cpu_supports("avx2") ) {
+    quality_stats_avx2(q, s, n, c, sum, min, count);
+    return;
+  }
+#endif
+  quality_stats_plain(q, s, n, c, sum, min, count);
+}
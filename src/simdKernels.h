@@ -0,0 +1,28 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+/*
+  Vectorized kernels working on arrays of bytes (sequences)
+
+  On x86-64 with gcc or clang the AVX2 versions are used if the CPU has
+  AVX2 (checked at runtime), otherwise the plain C versions are used.
+  Compile with -DNOSIMD to only use the plain C versions.
+*/
+
+int simd_level();
+void translate_bytes(char *s, long n, const char *table);
+void translate_count_bytes(char *s, long n, const char *table, long *counts, int ncounts);
+void revcomp_ends(char *s, long n, long from, long k, const char *comp, int ncomp);
+void revcomp_bytes(char *s, char *r, long n, const char *comp, int ncomp);
+void translate_copy_bytes(const char *s, char *d, long n, const char *table, int ntable);
+void translate_codons(const char *s, long from, long to, const char *codes, const char *ccodes,
+		      int ncodes, const char *gcode, char *fwd, char *rev);
+void quality_stats(const char *q, const char *s, long n, int c, long *sum, int *min, long *count);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+/*
+  Six-frame translation (see translation.h)
+
+  Example:
+
+  makeGeneticCode(dna,protein);
+  fwd = (char *)malloc(seq->len*sizeof(char));
+  rev = (char *)malloc(seq->len*sizeof(char));
+  translate6_Sequence(seq, dna, fwd, rev, 8);
+  for (frame=0; frame<6; ++frame) {
+    n = frame_translation(fwd, rev, seq->len, frame, prot);
+    ...
+  }
+
+  Long sequences are cut in chunks that are translated by inThreads
+  workers. The chunks overlap by two bases, so the result is the same
+  as for one thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inThreads.h"
+#include "simpleHash.h"
+#include "fileBuffer.h"
+#include "simdKernels.h"
+#include "sequence.h"
+#include "translation.h"
+
+// Sequences shorter than this are translated without threads
+#define TRANSLATE_CHUNK (1<<22)
+
+
+typedef struct {
+  char *s;
+  long from, to;
+  codonTables *ct;
+  char *fwd, *rev;
+} translateJob;
+
+
+static int translate_chunk(int thread, void *x) {
+  translateJob *job = (translateJob *)x;
+  codonTables *ct = job->ct;
+  translate_codons(job->s, job->from, job->to, ct->codes, ct->ccodes, ct->ncodes, ct->gcode, job->fwd, job->rev);
+  return 0;
+}
+
+
+/*
+  Translate seq in all six frames into fwd and rev (both of length
+  seq->len, see translation.h). rev can be NULL.
+*/
+void translate6_Sequence(Sequence *seq, AlphabetStruct *alph, char *fwd, char *rev, int nthreads) {
+  codonTables ct;
+  translateJob *jobs;
+  inThreads *threads;
+  long i, n, len=seq->len;
+  int njobs, done;
+
+  make_codonTables(&ct, alph);
+
+  for (i=0; i<2 && i<len; ++i) {
+    fwd[i] = ct.gcode[64];
+    if (rev) rev[len-1-i] = ct.gcode[64];
+  }
+  if (len<3) return;
+
+  if ( nthreads<=1 || len<2*TRANSLATE_CHUNK ) {
+    translate_codons(seq->s, 2, len, ct.codes, ct.ccodes, ct.ncodes, ct.gcode, fwd, rev);
+    return;
+  }
+
+  njobs = (len+TRANSLATE_CHUNK-1)/TRANSLATE_CHUNK;
+  jobs = (translateJob *)malloc(njobs*sizeof(translateJob));
+  threads = init_inThreads(nthreads, translate_chunk);
+  for (i=0, n=2; i<njobs; ++i, n+=TRANSLATE_CHUNK) {
+    jobs[i].s = seq->s;
+    jobs[i].from = n;
+    jobs[i].to = MINIMUM(n+TRANSLATE_CHUNK, len);
+    jobs[i].ct = &ct;
+    jobs[i].fwd = fwd;
+    jobs[i].rev = rev;
+    new_job_inThreads(threads, (void *)(jobs+i));
+  }
+  finished_jobqueue_inThreads(threads);
+  start_inThreads(threads);
+
+  for (done=0; done<njobs; ) {
+    if ( next_output_inThreads(threads) ) ++done;
+    else millisleep(threads->sleep);
+  }
+
+  cleanup_inThreads(threads);
+  free(jobs);
+}
+
+
+/*
+  Write the protein of one frame to prot and return its length.
+  Frames 0-2 are the forward strand starting at base 0, 1 and 2, and
+  frames 3-5 are the reverse strand starting at the last, second last and
+  third last base. prot must have room for len/3 chars.
+*/
+long frame_translation(char *fwd, char *rev, long len, int frame, char *prot) {
+  long i, n=0;
+
+  if (frame<3) for (i=frame+2; i<len; i+=3) prot[n++] = fwd[i];
+  else for (i=len-3-(frame-3); i>=0; i-=3) prot[n++] = rev[i];
+
+  return n;
+}
+
+
+
+/*************************************************
+
+Streaming translation
+
+Example translating a sequence read in windows into buffers of the same
+size as the window:
+
+  translateStream *ts = alloc_translateStream(dna);
+  while ( (n=read_window(window)) > 0 ) {
+    next_translateStream(ts, window, n, fwd, rev);
+    ...
+  }
+  free(ts);
+
+Call reset_translateStream before the next sequence.
+
+*************************************************/
+
+
+translateStream *alloc_translateStream(AlphabetStruct *alph) {
+  translateStream *ts = (translateStream *)malloc(sizeof(translateStream));
+  make_codonTables(&(ts->ct), alph);
+  reset_translateStream(ts);
+  return ts;
+}
+
+
+// Start a new sequence
+void reset_translateStream(translateStream *ts) {
+  // Number 0 is never a base, so codons with these are X
+  ts->carry[0] = ts->carry[1] = 0;
+  ts->pos = 0;
+}
+
+
+/*
+  Translate the next n bases of the sequence into fwd and rev (each of
+  length n, rev can be NULL). Returns n.
+*/
+long next_translateStream(translateStream *ts, char *s, long n, char *fwd, char *rev) {
+  codonTables *ct = &(ts->ct);
+  char head[4], f[4], r[4];
+  long k = MINIMUM(n,2);
+
+  if (n<=0) return 0;
+
+  // The first two positions use the carried bases
+  head[0] = ts->carry[0];
+  head[1] = ts->carry[1];
+  memcpy(head+2, s, k);
+  translate_codons(head, 2, 2+k, ct->codes, ct->ccodes, ct->ncodes, ct->gcode, f, r);
+  memcpy(fwd, f+2, k);
+  if (rev) memcpy(rev, r, k);
+
+  if (n>2) translate_codons(s, 2, n, ct->codes, ct->ccodes, ct->ncodes, ct->gcode, fwd, (rev?rev+2:NULL));
+
+  // Carry the last two bases
+  if (n>=2) { ts->carry[0] = s[n-2]; ts->carry[1] = s[n-1]; }
+  else { ts->carry[0] = ts->carry[1]; ts->carry[1] = s[0]; }
+  ts->pos += n;
+
+  return n;
+}
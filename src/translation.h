@@ -0,0 +1,49 @@
+/*
+This file is part of the aklib c library
+Copyright 2016-2021 by Anders Krogh.
+aklib licensed under the GPLv3, see the file LICENSE.
+*/
+
+#ifndef TRANSLATION_H
+#define TRANSLATION_H
+
+/*
+  Six-frame translation of DNA
+
+  Both strands are translated in one pass into two arrays of the same
+  length as the sequence:
+    fwd[i]   is the amino acid of codon s[i-2..i] (fwd[0] and fwd[1] are X)
+    rev[i]   is the amino acid of the reverse complement of s[i..i+2]
+             (rev[len-2] and rev[len-1] are X)
+  so fwd is what translateDNA returns, and each strand holds three frames.
+  frame_translation extracts the protein of a single frame.
+
+  translateStream translates a sequence given in windows of any size
+  (e.g. while reading a chromosome) in bounded memory. The last two bases
+  of a window are carried over to the next. Here the amino acids of both
+  strands are given for the codon ending at each position:
+    fwd[j]   is the amino acid of codon s[j-2..j]
+    rev[j]   is the amino acid of the reverse complement of s[j-2..j]
+  where positions before the window are the carried bases (so rev[j]
+  here is rev[j-2] above). The first two positions of a sequence are X.
+
+  makeGeneticCode must be called for the DNA alphabet first.
+
+  Include akstandard.h (or inThreads.h), simpleHash.h, fileBuffer.h and
+  sequence.h before this file.
+*/
+
+typedef struct {
+  codonTables ct;
+  char carry[2];     // Last two bases of the previous window
+  long pos;          // Number of bases translated
+} translateStream;
+
+
+void translate6_Sequence(Sequence *seq, AlphabetStruct *alph, char *fwd, char *rev, int nthreads);
+long frame_translation(char *fwd, char *rev, long len, int frame, char *prot);
+translateStream *alloc_translateStream(AlphabetStruct *alph);
+void reset_translateStream(translateStream *ts);
+long next_translateStream(translateStream *ts, char *s, long n, char *fwd, char *rev);
+
+#endif